@@ -0,0 +1,122 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_exchange.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+// Hammers FrameExchange from a producer and a consumer thread and checks
+// that the consumer sees the published slots in order, complete, and
+// never overwritten while it owns them.
+
+namespace {
+
+constexpr auto kFrames = 200'000;
+constexpr auto kWords = 16;
+
+struct Slot {
+	int64 sequence = -1;
+	int64 words[kWords] = {};
+};
+
+[[nodiscard]] bool Run(int depth) {
+	auto exchange = Webrtc::details::FrameExchange<Slot>(depth);
+	auto written = int64(0);
+	auto dropped = int64(0);
+	auto producerDone = std::atomic<bool>(false);
+
+	auto producer = std::thread([&] {
+		for (auto i = 0; i != kFrames; ++i) {
+			const auto slot = exchange.slotForWrite();
+			if (!slot) {
+				++dropped;
+				std::this_thread::yield();
+				continue;
+			}
+			const auto sequence = exchange.indexForWrite();
+			slot->sequence = sequence;
+			for (auto &word : slot->words) {
+				word = sequence;
+			}
+			exchange.publish();
+			++written;
+		}
+		producerDone = true;
+	});
+
+	auto errors = 0;
+	auto shown = int64(0);
+	auto last = int64(0);
+	const auto check = [&](const Slot &slot, int64 expected) {
+		if (slot.sequence != expected) {
+			++errors;
+			return;
+		}
+		for (const auto word : slot.words) {
+			if (word != expected) {
+				++errors;
+				return;
+			}
+		}
+	};
+	while (true) {
+		const auto done = producerDone.load();
+		const auto next = exchange.nextForRead();
+		if (next) {
+			check(*next, exchange.indexForRead() + 1);
+		}
+		if (!exchange.markShown()) {
+			if (next) {
+				// A published slot must be possible to move to.
+				++errors;
+			}
+			if (done && !exchange.nextForRead()) {
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+		const auto index = exchange.indexForRead();
+		if (index <= last) {
+			++errors;
+		}
+		last = index;
+
+		// Read the owned slot twice, it must not change meanwhile.
+		const auto &slot = exchange.slotForRead();
+		check(slot, index);
+		std::this_thread::yield();
+		check(slot, index);
+		++shown;
+	}
+	producer.join();
+
+	if (shown != written || last != written) {
+		++errors;
+	}
+	std::printf(
+		"depth %d: written %lld, dropped %lld, shown %lld, errors %d\n",
+		depth,
+		(long long)written,
+		(long long)dropped,
+		(long long)shown,
+		errors);
+	return !errors;
+}
+
+} // namespace
+
+int main() {
+	auto failed = 0;
+	for (auto depth = 2; depth != 6; ++depth) {
+		if (!Run(depth)) {
+			++failed;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
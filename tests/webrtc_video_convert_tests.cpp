@@ -0,0 +1,230 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_video_convert.h"
+#include "webrtc/webrtc_video_track.h"
+#include "ffmpeg/ffmpeg_utility.h"
+
+#include <QtGui/QImage>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// Compares the same-size I420 -> ARGB32 conversion with the swscale one
+// it replaced and with a floating point BT.601 limited range reference,
+// on synthetic frames of the usual sizes (the ones converted in stripes
+// included). The results may differ only in rounding.
+//
+// swscale itself is off by a lot for odd sizes, those are compared with
+// the reference only.
+
+namespace {
+
+// Largest measured differences of a color channel, out of 255.
+constexpr auto kMaxSwscaleDifference = 4;
+constexpr auto kMaxReferenceDifference = 3;
+
+// swscale reads the planes with SIMD and needs aligned rows.
+constexpr auto kStrideAlign = 64;
+
+struct Planes {
+	QSize size;
+	QSize chroma;
+	int yStride = 0;
+	int chromaStride = 0;
+	std::vector<uint8> y;
+	std::vector<uint8> u;
+	std::vector<uint8> v;
+
+	[[nodiscard]] Webrtc::FrameYUV420 wrap() const;
+};
+
+Webrtc::FrameYUV420 Planes::wrap() const {
+	return {
+		.size = size,
+		.chromaSize = chroma,
+		.y = { y.data(), yStride },
+		.u = { u.data(), chromaStride },
+		.v = { v.data(), chromaStride },
+	};
+}
+
+[[nodiscard]] int AlignStride(int bytes) {
+	return ((bytes + kStrideAlign - 1) / kStrideAlign) * kStrideAlign;
+}
+
+// Gradients in all the channels with some noise, so that both the
+// smooth areas and the sharp chroma edges are covered.
+[[nodiscard]] Planes GeneratePlanes(QSize size, uint32 seed) {
+	auto generator = std::mt19937(seed);
+	auto noise = std::uniform_int_distribution<int>(-24, 24);
+	const auto clamp = [](int value) {
+		return uint8(std::clamp(value, 0, 255));
+	};
+	const auto chroma = QSize(
+		(size.width() + 1) / 2,
+		(size.height() + 1) / 2);
+	auto result = Planes{
+		.size = size,
+		.chroma = chroma,
+		.yStride = AlignStride(size.width()),
+		.chromaStride = AlignStride(chroma.width()),
+	};
+	result.y.resize(result.yStride * size.height());
+	result.u.resize(result.chromaStride * chroma.height());
+	result.v.resize(result.chromaStride * chroma.height());
+	for (auto row = 0; row != size.height(); ++row) {
+		for (auto column = 0; column != size.width(); ++column) {
+			const auto value = (column * 255) / size.width();
+			result.y[row * result.yStride + column] = clamp(
+				value + noise(generator));
+		}
+	}
+	for (auto row = 0; row != chroma.height(); ++row) {
+		for (auto column = 0; column != chroma.width(); ++column) {
+			const auto index = row * result.chromaStride + column;
+			const auto u = (row * 255) / chroma.height();
+			const auto v = 255 - (column * 255) / chroma.width();
+			result.u[index] = clamp(u + noise(generator));
+			result.v[index] = clamp(v + noise(generator));
+		}
+	}
+	return result;
+}
+
+[[nodiscard]] QImage ConvertWithSwscale(const Planes &planes) {
+	auto result = FFmpeg::CreateFrameStorage(planes.size);
+	const auto context = FFmpeg::MakeSwscalePointer(
+		planes.size,
+		AV_PIX_FMT_YUV420P,
+		planes.size,
+		AV_PIX_FMT_BGRA);
+	Assert(context != nullptr);
+
+	const auto wrapped = planes.wrap();
+	const uint8_t *src[AV_NUM_DATA_POINTERS] = {
+		planes.y.data(),
+		planes.u.data(),
+		planes.v.data(),
+		nullptr,
+	};
+	int srcLineSize[AV_NUM_DATA_POINTERS] = {
+		wrapped.y.stride,
+		wrapped.u.stride,
+		wrapped.v.stride,
+		0,
+	};
+	uint8_t *dst[AV_NUM_DATA_POINTERS] = { result.bits(), nullptr };
+	int dstLineSize[AV_NUM_DATA_POINTERS] = {
+		int(result.bytesPerLine()),
+		0,
+	};
+	sws_scale(
+		context.get(),
+		src,
+		srcLineSize,
+		0,
+		result.height(),
+		dst,
+		dstLineSize);
+	return result;
+}
+
+// BGRA bytes of the pixel, the chroma sample is taken as is.
+[[nodiscard]] std::array<uint8, 3> ConvertWithReference(
+		const Planes &planes,
+		int column,
+		int row) {
+	const auto chroma = (row / 2) * planes.chromaStride + (column / 2);
+	const auto y = 1.164 * (planes.y[row * planes.yStride + column] - 16);
+	const auto u = planes.u[chroma] - 128.;
+	const auto v = planes.v[chroma] - 128.;
+	const auto clamp = [](float64 value) {
+		return uint8(std::clamp(int(value + 0.5), 0, 255));
+	};
+	return {
+		clamp(y + 2.018 * u),
+		clamp(y - 0.391 * u - 0.813 * v),
+		clamp(y + 1.596 * v),
+	};
+}
+
+[[nodiscard]] bool Compare(QSize size, uint32 seed) {
+	const auto planes = GeneratePlanes(size, seed);
+	const auto even = !(size.width() % 2) && !(size.height() % 2);
+	const auto expected = even ? ConvertWithSwscale(planes) : QImage();
+	auto converted = FFmpeg::CreateFrameStorage(size);
+	if (!Webrtc::details::ConvertToARGB32(planes.wrap(), converted)) {
+		std::printf("%dx%d: conversion failed\n", size.width(), size.height());
+		return false;
+	}
+
+	auto maxSwscale = 0;
+	auto sumSwscale = int64(0);
+	auto maxReference = 0;
+	auto opaque = true;
+	for (auto row = 0; row != size.height(); ++row) {
+		const auto b = converted.constScanLine(row);
+		for (auto column = 0; column != size.width(); ++column) {
+			const auto reference = ConvertWithReference(planes, column, row);
+			for (auto channel = 0; channel != 3; ++channel) {
+				const auto index = column * 4 + channel;
+				maxReference = std::max(
+					maxReference,
+					std::abs(int(reference[channel]) - int(b[index])));
+				if (even) {
+					const auto a = expected.constScanLine(row);
+					const auto difference = std::abs(
+						int(a[index]) - int(b[index]));
+					maxSwscale = std::max(maxSwscale, difference);
+					sumSwscale += difference;
+				}
+			}
+			opaque = opaque && (b[column * 4 + 3] == 255);
+		}
+	}
+	const auto samples = int64(size.width()) * size.height() * 3;
+	std::printf(
+		"%dx%d: swscale max %d, mean %.3f, reference max %d%s\n",
+		size.width(),
+		size.height(),
+		maxSwscale,
+		double(sumSwscale) / samples,
+		maxReference,
+		opaque ? "" : ", NOT OPAQUE");
+	return opaque
+		&& (maxSwscale <= kMaxSwscaleDifference)
+		&& (maxReference <= kMaxReferenceDifference);
+}
+
+} // namespace
+
+int main() {
+	const auto sizes = {
+		QSize(320, 180),
+		QSize(641, 361),
+		QSize(642, 362),
+		QSize(854, 480),
+		QSize(1280, 720),
+		QSize(1366, 768),
+		QSize(1920, 1080),
+		QSize(2560, 1440),
+		QSize(3840, 2160),
+		QSize(5120, 2880),
+	};
+	auto failed = 0;
+	auto seed = uint32(1);
+	for (const auto size : sizes) {
+		if (!Compare(size, seed++)) {
+			++failed;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
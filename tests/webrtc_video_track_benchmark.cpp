@@ -0,0 +1,521 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/webrtc_video_track.h"
+#include "webrtc/details/webrtc_stripes.h"
+#include "webrtc/details/webrtc_video_convert.h"
+#include "webrtc/details/webrtc_video_stats.h"
+
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <api/video/i420_buffer.h>
+#include <api/video/nv12_buffer.h>
+#include <api/video/video_frame.h>
+#include <libyuv/convert_argb.h>
+
+// Feeds synthetic frames to VideoTrack sinks from one or several threads
+// while the main thread paints them in a few views, the way the calls
+// grid does, and reports the throughput, the CPU time per frame, the
+// latency from OnFrame to paint and of each stage on the way. Runs
+// headless, without a camera or a GPU.
+//
+// Then converts large frames to ARGB32 in 1, 2, 4 and 8 stripes the way
+// the same-size conversion does, to tune the size it starts from.
+//
+// And letterboxes opaque ARGB32 frames into typical tiles directly and
+// with the QPainter fills and the smooth drawImage() it replaced.
+//
+// Usage: webrtc_video_track_benchmark [frames per case]
+
+namespace {
+
+constexpr auto kDefaultFrames = 240;
+constexpr auto kIdleTimeout = crl::time(100);
+constexpr auto kStripesFrames = 60;
+constexpr auto kLetterboxFrames = 200;
+
+enum class Source {
+	I420,
+	NV12,
+};
+
+struct Case {
+	Source source = Source::I420;
+	QSize size;
+	int rotation = 0;
+	int threads = 1;
+};
+
+struct MainTask {
+	void (*callable)(void*) = nullptr;
+	void *argument = nullptr;
+};
+
+// The main queue, processed on the thread running main().
+std::mutex QueueMutex;
+std::condition_variable QueueChanged;
+std::deque<MainTask> Queue;
+
+void PostToMain(void (*callable)(void*), void *argument) {
+	{
+		auto lock = std::unique_lock(QueueMutex);
+		Queue.push_back({ callable, argument });
+	}
+	QueueChanged.notify_one();
+}
+
+// Processes the main queue until `done` returns true and nothing was
+// posted for a while, returns the time the last task was finished.
+crl::time RunMainQueue(Fn<bool()> done) {
+	auto idleSince = crl::now();
+	while (true) {
+		auto task = MainTask();
+		{
+			auto lock = std::unique_lock(QueueMutex);
+			QueueChanged.wait_for(lock, std::chrono::milliseconds(5), [] {
+				return !Queue.empty();
+			});
+			if (!Queue.empty()) {
+				task = Queue.front();
+				Queue.pop_front();
+			}
+		}
+		if (task.callable) {
+			task.callable(task.argument);
+			idleSince = crl::now();
+		} else if (done() && (idleSince + kIdleTimeout < crl::now())) {
+			return idleSince;
+		}
+	}
+}
+
+[[nodiscard]] const char *SourceName(Source source) {
+	switch (source) {
+	case Source::I420: return "I420";
+	case Source::NV12: return "NV12";
+	}
+	Unexpected("Source in SourceName.");
+}
+
+[[nodiscard]] uint8 Pattern(int x, int y, int shift) {
+	return uint8(((x + shift) ^ (y * 3)) & 0xFF);
+}
+
+[[nodiscard]] rtc::scoped_refptr<webrtc::VideoFrameBuffer> GenerateBuffer(
+		Source source,
+		QSize size,
+		int shift) {
+	const auto width = size.width();
+	const auto height = size.height();
+	const auto chromaWidth = (width + 1) / 2;
+	const auto chromaHeight = (height + 1) / 2;
+	if (source == Source::I420) {
+		const auto result = webrtc::I420Buffer::Create(width, height);
+		for (auto y = 0; y != height; ++y) {
+			const auto row = result->MutableDataY() + y * result->StrideY();
+			for (auto x = 0; x != width; ++x) {
+				row[x] = Pattern(x, y, shift);
+			}
+		}
+		for (auto y = 0; y != chromaHeight; ++y) {
+			const auto u = result->MutableDataU() + y * result->StrideU();
+			const auto v = result->MutableDataV() + y * result->StrideV();
+			for (auto x = 0; x != chromaWidth; ++x) {
+				u[x] = Pattern(y, x, shift);
+				v[x] = Pattern(x, x + y, shift);
+			}
+		}
+		return result;
+	}
+	const auto result = webrtc::NV12Buffer::Create(width, height);
+	for (auto y = 0; y != height; ++y) {
+		const auto row = result->MutableDataY() + y * result->StrideY();
+		for (auto x = 0; x != width; ++x) {
+			row[x] = Pattern(x, y, shift);
+		}
+	}
+	for (auto y = 0; y != chromaHeight; ++y) {
+		const auto row = result->MutableDataUV() + y * result->StrideUV();
+		for (auto x = 0; x != chromaWidth; ++x) {
+			row[2 * x] = Pattern(y, x, shift);
+			row[2 * x + 1] = Pattern(x, x + y, shift);
+		}
+	}
+	return result;
+}
+
+// Views of the same track: a pinned tile, a grid tile and a rounded
+// picture-in-picture one, each fitting the frame into its own size.
+[[nodiscard]] std::vector<Webrtc::FrameRequest> GenerateRequests(
+		QSize frame,
+		int rotation) {
+	using namespace Webrtc;
+
+	const auto shown = (rotation == 90 || rotation == 270)
+		? frame.transposed()
+		: frame;
+	const auto fit = [&](QSize outer, int radius, FrameQuality quality) {
+		return FrameRequest{
+			.resize = shown.scaled(outer, Qt::KeepAspectRatio),
+			.outer = outer,
+			.radius = radius,
+			.quality = quality,
+		};
+	};
+	return {
+		fit(QSize(1280, 720), 0, FrameQuality::High),
+		fit(QSize(480, 270), 0, FrameQuality::Bilinear),
+		fit(QSize(320, 180), 12, FrameQuality::High),
+	};
+}
+
+[[nodiscard]] Webrtc::VideoLatencyStats Merge(
+		Webrtc::VideoLatencyStats a,
+		const Webrtc::VideoLatencyStats &b) {
+	for (auto i = 0; i != Webrtc::VideoLatencyStats::kBuckets; ++i) {
+		a.buckets[i] += b.buckets[i];
+	}
+	a.count += b.count;
+	a.sum += b.sum;
+	a.max = std::max(a.max, b.max);
+	return a;
+}
+
+[[nodiscard]] float64 Milliseconds(int64 microseconds) {
+	return microseconds / 1000.;
+}
+
+void Run(const Case &data, int frames) {
+	using namespace Webrtc;
+
+	struct Painted {
+		std::unique_ptr<VideoTrack> track;
+		std::shared_ptr<SinkInterface> sink;
+		rpl::lifetime lifetime;
+	};
+	const auto requests = GenerateRequests(data.size, data.rotation);
+	auto tracks = std::vector<Painted>();
+	auto painted = int64(0);
+
+	// The frames are stamped with crl::profile() when passed to OnFrame.
+	auto endToEnd = details::LatencyHistogram();
+	for (auto i = 0; i != data.threads; ++i) {
+		auto track = std::make_unique<VideoTrack>(VideoState::Active);
+		const auto raw = track.get();
+		tracks.push_back({ .track = std::move(track), .sink = raw->sink() });
+		raw->renderNextFrame() | rpl::start_with_next([=, &painted, &endToEnd] {
+			for (const auto &request : requests) {
+				if (!raw->frame(request).isNull()) {
+					++painted;
+				}
+			}
+			const auto info = raw->frameWithInfo(true);
+			if (info.mcstimestamp) {
+				endToEnd.add(crl::profile() - info.mcstimestamp);
+			}
+			raw->markFrameShown();
+		}, tracks.back().lifetime);
+	}
+
+	// A few different buffers, so that nothing is cached between frames.
+	auto buffers = std::vector<rtc::scoped_refptr<webrtc::VideoFrameBuffer>>();
+	for (auto i = 0; i != 4; ++i) {
+		buffers.push_back(GenerateBuffer(data.source, data.size, i * 16));
+	}
+
+	const auto rotation = webrtc::VideoRotation(data.rotation);
+	auto finished = std::atomic<int>(0);
+	auto producers = std::vector<std::thread>();
+	const auto started = crl::now();
+	const auto cpuStarted = std::clock();
+	for (const auto &entry : tracks) {
+		producers.emplace_back([&, sink = entry.sink] {
+			for (auto i = 0; i != frames; ++i) {
+				const auto frame = webrtc::VideoFrame::Builder()
+					.set_video_frame_buffer(buffers[i % buffers.size()])
+					.set_rotation(rotation)
+					.set_timestamp_us(crl::profile())
+					.build();
+				sink->OnFrame(frame);
+			}
+			++finished;
+		});
+	}
+	const auto last = RunMainQueue([&] {
+		return (finished.load() == int(producers.size()));
+	});
+	const auto cpu = float64(std::clock() - cpuStarted) / CLOCKS_PER_SEC;
+	const auto elapsed = std::max(last - started, crl::time(1)) / 1000.;
+	for (auto &producer : producers) {
+		producer.join();
+	}
+
+	auto stats = VideoTrackStats();
+	for (const auto &entry : tracks) {
+		const auto track = entry.track->stats();
+		stats.framesReceived += track.framesReceived;
+		stats.framesDropped += track.framesDropped;
+		stats.framesDecimated += track.framesDecimated;
+		stats.framesShown += track.framesShown;
+		stats.conversion = Merge(stats.conversion, track.conversion);
+		stats.preparation = Merge(stats.preparation, track.preparation);
+		stats.presentation = Merge(stats.presentation, track.presentation);
+	}
+	tracks.clear();
+	RunMainQueue([] { return true; });
+
+	const auto received = std::max(stats.framesReceived, int64(1));
+	std::printf(
+		"%s %4dx%-4d rotation %3d, %d thread(s): "
+		"received %.1f/s, shown %.1f/s, dropped %lld, decimated %lld, "
+		"cpu %.2f ms/frame, painted %lld\n",
+		SourceName(data.source),
+		data.size.width(),
+		data.size.height(),
+		data.rotation,
+		data.threads,
+		stats.framesReceived / elapsed,
+		stats.framesShown / elapsed,
+		(long long)stats.framesDropped,
+		(long long)stats.framesDecimated,
+		cpu * 1000. / received,
+		(long long)painted);
+	const auto latency = [](const char *name, const VideoLatencyStats &v) {
+		std::printf(
+			"    %-12s p50 %7.2f, p90 %7.2f, p99 %7.2f, max %7.2f ms\n",
+			name,
+			Milliseconds(v.percentile(0.5)),
+			Milliseconds(v.percentile(0.9)),
+			Milliseconds(v.percentile(0.99)),
+			Milliseconds(v.max));
+	};
+
+	// OnFrame -> paint is the conversion, the preparation in the sink and
+	// the presentation, from publishing the frame until it is shown.
+	latency("end-to-end", endToEnd.snapshot());
+	latency("conversion", stats.conversion);
+	latency("preparation", stats.preparation);
+	latency("presentation", stats.presentation);
+}
+
+void RunStripes(QSize size) {
+	const auto source = GenerateBuffer(Source::I420, size, 0);
+	const auto i420 = source->GetI420();
+	auto result = QImage(size, QImage::Format_ARGB32_Premultiplied);
+	const auto stride = int(result.bytesPerLine());
+	const auto data = result.bits();
+
+	auto single = float64(0);
+	for (const auto workers : { 1, 2, 4, 8 }) {
+		// Even rows in each stripe, so that the chroma rows are not shared.
+		const auto height = size.height();
+		const auto rows = ((height + workers - 1) / workers + 1) & ~1;
+		const auto convert = [&](int index) {
+			const auto top = index * rows;
+			const auto count = std::min(rows, height - top);
+			if (count <= 0) {
+				return;
+			}
+			const auto chroma = top / 2;
+			libyuv::I420ToARGB(
+				i420->DataY() + top * i420->StrideY(),
+				i420->StrideY(),
+				i420->DataU() + chroma * i420->StrideU(),
+				i420->StrideU(),
+				i420->DataV() + chroma * i420->StrideV(),
+				i420->StrideV(),
+				data + top * stride,
+				stride,
+				size.width(),
+				count);
+		};
+		Webrtc::details::RunInStripes(workers, convert); // Warm up.
+
+		const auto started = crl::profile();
+		for (auto i = 0; i != kStripesFrames; ++i) {
+			Webrtc::details::RunInStripes(workers, convert);
+		}
+		const auto perFrame = Milliseconds(crl::profile() - started)
+			/ kStripesFrames;
+		if (workers == 1) {
+			single = perFrame;
+		}
+		std::printf(
+			"stripes %4dx%-4d, %d worker(s): %.2f ms/frame, x%.2f\n",
+			size.width(),
+			size.height(),
+			workers,
+			perFrame,
+			perFrame > 0 ? (single / perFrame) : 0.);
+	}
+}
+
+// The way PrepareByRequest() painted opaque frames before, with the
+// black bars filled separately and the frame drawn with all the hints.
+void LetterboxWithPainter(
+		const QImage &from,
+		QImage &to,
+		QRect inner,
+		int rotation) {
+	auto p = QPainter(&to);
+	const auto outer = to.size();
+	const auto left = inner.x();
+	const auto right = outer.width() - inner.width() - left;
+	const auto top = inner.y();
+	const auto bottom = outer.height() - inner.height() - top;
+	if (left > 0) {
+		p.fillRect(0, 0, left, outer.height(), Qt::black);
+	}
+	if (right > 0) {
+		p.fillRect(left + inner.width(), 0, right, outer.height(), Qt::black);
+	}
+	if (top > 0) {
+		p.fillRect(left, 0, inner.width(), top, Qt::black);
+	}
+	if (bottom > 0) {
+		p.fillRect(
+			left,
+			top + inner.height(),
+			inner.width(),
+			bottom,
+			Qt::black);
+	}
+	p.setRenderHint(QPainter::Antialiasing);
+	p.setRenderHint(QPainter::SmoothPixmapTransform);
+	p.setRenderHint(QPainter::TextAntialiasing);
+	if (rotation == 90) {
+		p.rotate(90);
+		p.drawImage(
+			QRect(
+				inner.y(),
+				-inner.x() - inner.width(),
+				inner.height(),
+				inner.width()),
+			from);
+	} else {
+		p.drawImage(inner, from);
+	}
+}
+
+void RunLetterbox(QSize outer, int rotation) {
+	const auto frame = QSize(1280, 720);
+	auto from = QImage(frame, QImage::Format_ARGB32_Premultiplied);
+	for (auto y = 0; y != frame.height(); ++y) {
+		const auto row = reinterpret_cast<uint32*>(from.scanLine(y));
+		for (auto x = 0; x != frame.width(); ++x) {
+			row[x] = 0xFF000000U
+				| (uint32(Pattern(x, y, 0)) << 16)
+				| (uint32(Pattern(y, x, 0)) << 8)
+				| uint32(Pattern(x, x + y, 0));
+		}
+	}
+	const auto shown = rotation ? frame.transposed() : frame;
+	const auto size = shown.scaled(outer, Qt::KeepAspectRatio);
+	const auto inner = QRect(
+		QPoint(
+			(outer.width() - size.width()) / 2,
+			(outer.height() - size.height()) / 2),
+		size);
+	auto to = QImage(outer, QImage::Format_ARGB32_Premultiplied);
+
+	const auto measure = [&](const char *name, Fn<void()> method) {
+		method(); // Warm up.
+		const auto started = crl::profile();
+		for (auto i = 0; i != kLetterboxFrames; ++i) {
+			method();
+		}
+		const auto perFrame = Milliseconds(crl::profile() - started)
+			/ kLetterboxFrames;
+		std::printf(
+			"letterbox %4dx%-4d rotation %2d, %-8s: %.3f ms/frame\n",
+			outer.width(),
+			outer.height(),
+			rotation,
+			name,
+			perFrame);
+	};
+	measure("QPainter", [&] {
+		LetterboxWithPainter(from, to, inner, rotation);
+	});
+	measure("direct", [&] {
+		const auto scaled = Webrtc::details::ScaleToARGB32(
+			from,
+			to,
+			inner,
+			rotation,
+			Webrtc::FrameQuality::High);
+		Assert(scaled);
+	});
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+	const auto frames = (argc > 1)
+		? std::max(std::atoi(argv[1]), 1)
+		: kDefaultFrames;
+
+	crl::init_main_queue(PostToMain);
+
+	// Notify about each frame right away, there is no event loop here.
+	Webrtc::SetFrameNotificationInterval(0);
+
+	const auto sizes = {
+		QSize(320, 180),
+		QSize(640, 360),
+		QSize(1280, 720),
+		QSize(1920, 1080),
+		QSize(3840, 2160),
+	};
+	for (const auto source : { Source::I420, Source::NV12 }) {
+		for (const auto size : sizes) {
+			for (const auto rotation : { 0, 90, 180, 270 }) {
+				Run({ source, size, rotation, 1 }, frames);
+			}
+			Run({ source, size, 0, 4 }, frames);
+		}
+	}
+
+	std::printf(
+		"stripes on %d hardware thread(s)\n",
+		int(std::thread::hardware_concurrency()));
+	const auto large = {
+		QSize(1920, 1080),
+		QSize(2560, 1440),
+		QSize(3840, 2160),
+		QSize(5120, 2880),
+	};
+	for (const auto size : large) {
+		RunStripes(size);
+	}
+
+	// Square and portrait grid tiles, a pinned view and a 4:3 window.
+	const auto tiles = {
+		QSize(240, 240),
+		QSize(270, 480),
+		QSize(480, 480),
+		QSize(640, 480),
+		QSize(1280, 960),
+	};
+	for (const auto outer : tiles) {
+		for (const auto rotation : { 0, 90 }) {
+			RunLetterbox(outer, rotation);
+		}
+	}
+	return EXIT_SUCCESS;
+}
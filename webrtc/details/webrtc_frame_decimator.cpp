@@ -0,0 +1,92 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_decimator.h"
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kWindowFrames = 30;
+constexpr auto kMaxFactor = 4;
+constexpr auto kMaxLag = crl::time(100);
+constexpr auto kGoodWindowsToRecover = 3;
+
+} // namespace
+
+bool FrameDecimator::skip() {
+	if (_resetRequested.exchange(false, std::memory_order_acquire)) {
+		_phase = 0;
+		_windowFrames = _windowSkipped = _windowFull = _goodWindows = 0;
+		_factor.store(1, std::memory_order_relaxed);
+	}
+	if (++_windowFrames >= kWindowFrames) {
+		adapt();
+	}
+	const auto factor = _factor.load(std::memory_order_relaxed);
+	_phase = (_phase + 1) % factor;
+	if (!_phase) {
+		return false;
+	}
+	++_windowSkipped;
+	_skipped.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
+void FrameDecimator::queueFull() {
+	++_windowFull;
+}
+
+void FrameDecimator::shown(crl::time lag) {
+	_lagSum.fetch_add(std::max(lag, crl::time(0)), std::memory_order_relaxed);
+	_lagCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameDecimator::reset() {
+	// The producer owns the window, it starts a fresh one on the next frame.
+	_lagSum.store(0, std::memory_order_relaxed);
+	_lagCount.store(0, std::memory_order_relaxed);
+	_resetRequested.store(true, std::memory_order_release);
+}
+
+void FrameDecimator::adapt() {
+	const auto lagCount = _lagCount.exchange(0, std::memory_order_relaxed);
+	const auto lagSum = _lagSum.exchange(0, std::memory_order_relaxed);
+	const auto lag = lagCount ? (lagSum / lagCount) : crl::time(0);
+	const auto taken = _windowFrames - _windowSkipped;
+
+	// More than one of eight taken frames didn't fit into the queue.
+	const auto behind = (_windowFull * 8 > taken) || (lag > kMaxLag);
+	const auto caughtUp = !_windowFull && (lag <= kMaxLag / 2);
+
+	const auto factor = _factor.load(std::memory_order_relaxed);
+	auto updated = factor;
+	if (behind) {
+		_goodWindows = 0;
+		updated = std::min(factor + 1, kMaxFactor);
+	} else if (factor > 1 && caughtUp) {
+		if (++_goodWindows >= kGoodWindowsToRecover) {
+			_goodWindows = 0;
+			updated = factor - 1;
+		}
+	} else {
+		_goodWindows = 0;
+	}
+	if (updated != factor) {
+		_phase = 0;
+		_factor.store(updated, std::memory_order_relaxed);
+	}
+	_windowFrames = _windowSkipped = _windowFull = 0;
+}
+
+int FrameDecimator::factor() const {
+	return _factor.load(std::memory_order_relaxed);
+}
+
+int64 FrameDecimator::skippedCount() const {
+	return _skipped.load(std::memory_order_relaxed);
+}
+
+} // namespace Webrtc::details
@@ -0,0 +1,57 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <crl/crl_time.h>
+#include <atomic>
+
+namespace Webrtc::details {
+
+// Skips incoming frames of a track while its consumer can't keep up.
+//
+// The producer reports frames it couldn't queue and the consumer reports
+// how late the frames were shown. While there are many such frames or the
+// lag is big the producer processes only each `factor()` frame and
+// drops the others without converting them, when the consumer catches up
+// the factor goes back down, one step at a time.
+//
+// Lag and full queues say nothing while the consumer doesn't paint at all
+// (hidden or scrolled out tiles), so the owner shouldn't report them then
+// and should reset the decimator when the painting resumes.
+class FrameDecimator final {
+public:
+	// Called from the producer thread.
+	[[nodiscard]] bool skip();
+	void queueFull();
+
+	// Called from the consumer thread.
+	void shown(crl::time lag);
+	void reset();
+
+	// Called from any thread.
+	[[nodiscard]] int factor() const;
+	[[nodiscard]] int64 skippedCount() const;
+
+private:
+	void adapt();
+
+	std::atomic<int> _factor = 1;
+	std::atomic<int64> _skipped = 0;
+	std::atomic<int64> _lagSum = 0;
+	std::atomic<int> _lagCount = 0;
+	std::atomic<bool> _resetRequested = false;
+
+	// Producer thread.
+	int _phase = 0;
+	int _windowFrames = 0;
+	int _windowSkipped = 0;
+	int _windowFull = 0;
+	int _goodWindows = 0;
+
+};
+
+} // namespace Webrtc::details
@@ -0,0 +1,168 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+namespace Webrtc::details {
+
+// Single producer / single consumer exchange of `depth` frame slots.
+//
+// The consumer always owns exactly one slot, the one being painted.
+// The producer fills the slots after it in order and publishes them,
+// the consumer moves to the next published slot when it has shown
+// the current one. When all the other slots are published and not yet
+// shown the producer can't get a slot to write and should drop a frame.
+//
+// Slots are addressed by an ever increasing sequence number, slot for
+// the sequence `index` is `index % depth`, so no wraparound handling is
+// needed and the sequence number is a good unique frame index.
+template <typename Slot>
+class FrameExchange final {
+public:
+	explicit FrameExchange(int depth);
+
+	[[nodiscard]] int depth() const;
+
+	// Called from the producer thread.
+	[[nodiscard]] Slot *slotForWrite();
+	[[nodiscard]] int64 indexForWrite() const;
+	void publish();
+
+	// Called from the consumer thread.
+	[[nodiscard]] Slot &slotForRead();
+	[[nodiscard]] Slot *nextForRead();
+	[[nodiscard]] int64 indexForRead() const;
+	bool markShown();
+
+	// Called from the consumer thread, the slot being painted and the
+	// published ones after it.
+	template <typename Callback>
+	void enumerateForRead(Callback &&callback);
+
+	// Called from the producer thread, or while it is known to be idle,
+	// the slots it will write next, holding the frames already shown.
+	template <typename Callback>
+	void enumerateForWrite(Callback &&callback);
+
+	// Called from any thread.
+	[[nodiscard]] bool firstPublishHappened() const;
+
+	// Not thread safe, for setup and teardown of the slots.
+	template <typename Callback>
+	void enumerate(Callback &&callback);
+
+private:
+	std::vector<Slot> _slots;
+
+	// Sequence number of the slot being painted.
+	std::atomic<int64> _shown = 0;
+
+	// Sequence number of the next slot to be written.
+	std::atomic<int64> _published = 1;
+
+};
+
+template <typename Slot>
+FrameExchange<Slot>::FrameExchange(int depth) : _slots(depth) {
+	Expects(depth >= 2);
+}
+
+template <typename Slot>
+int FrameExchange<Slot>::depth() const {
+	return int(_slots.size());
+}
+
+template <typename Slot>
+Slot *FrameExchange<Slot>::slotForWrite() {
+	const auto published = _published.load(std::memory_order_relaxed);
+	const auto shown = _shown.load(std::memory_order_acquire);
+	return (published - shown < depth())
+		? &_slots[published % depth()]
+		: nullptr;
+}
+
+template <typename Slot>
+int64 FrameExchange<Slot>::indexForWrite() const {
+	return _published.load(std::memory_order_relaxed);
+}
+
+template <typename Slot>
+void FrameExchange<Slot>::publish() {
+	const auto published = _published.load(std::memory_order_relaxed);
+
+	Assert(published - _shown.load(std::memory_order_acquire) < depth());
+	_published.store(published + 1, std::memory_order_release);
+}
+
+template <typename Slot>
+Slot &FrameExchange<Slot>::slotForRead() {
+	return _slots[indexForRead() % depth()];
+}
+
+template <typename Slot>
+Slot *FrameExchange<Slot>::nextForRead() {
+	const auto shown = _shown.load(std::memory_order_relaxed);
+	const auto published = _published.load(std::memory_order_acquire);
+	return (shown + 1 < published)
+		? &_slots[(shown + 1) % depth()]
+		: nullptr;
+}
+
+template <typename Slot>
+int64 FrameExchange<Slot>::indexForRead() const {
+	return _shown.load(std::memory_order_relaxed);
+}
+
+template <typename Slot>
+bool FrameExchange<Slot>::markShown() {
+	const auto shown = _shown.load(std::memory_order_relaxed);
+	const auto published = _published.load(std::memory_order_acquire);
+	if (shown + 1 >= published) {
+		return false;
+	}
+	_shown.store(shown + 1, std::memory_order_release);
+	return true;
+}
+
+template <typename Slot>
+bool FrameExchange<Slot>::firstPublishHappened() const {
+	return _published.load(std::memory_order_acquire) > 1;
+}
+
+template <typename Slot>
+template <typename Callback>
+void FrameExchange<Slot>::enumerateForRead(Callback &&callback) {
+	const auto shown = _shown.load(std::memory_order_relaxed);
+	const auto published = _published.load(std::memory_order_acquire);
+	for (auto index = shown; index != published; ++index) {
+		callback(_slots[index % depth()]);
+	}
+}
+
+template <typename Slot>
+template <typename Callback>
+void FrameExchange<Slot>::enumerateForWrite(Callback &&callback) {
+	// The consumer may show more frames meanwhile, which only gives
+	// the producer more slots, so the ones enumerated stay its own.
+	const auto published = _published.load(std::memory_order_acquire);
+	const auto shown = _shown.load(std::memory_order_acquire);
+	for (auto index = published; index != shown + depth(); ++index) {
+		callback(_slots[index % depth()]);
+	}
+}
+
+template <typename Slot>
+template <typename Callback>
+void FrameExchange<Slot>::enumerate(Callback &&callback) {
+	for (auto &slot : _slots) {
+		callback(slot);
+	}
+}
+
+} // namespace Webrtc::details
@@ -0,0 +1,70 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace Webrtc::details {
+
+// Triple buffer passing the latest value to a single consumer.
+//
+// The producer writes the back value and swaps it with the middle one,
+// the consumer swaps its front value with the middle one if it is newer.
+// Both sides do a single atomic exchange, so none of them ever waits
+// for the other, and the values are destroyed on the producer thread.
+// Several producers must be serialized by the caller.
+template <typename Value>
+class FrameMailbox final {
+public:
+	// Called from the producer thread.
+	[[nodiscard]] Value &back();
+	void publish();
+
+	// Called from the consumer thread.
+	// Returns true if the front value was replaced by a newer one.
+	bool update();
+	[[nodiscard]] Value &front();
+
+private:
+	static constexpr auto kFresh = 0x04;
+	static constexpr auto kIndexMask = 0x03;
+
+	std::array<Value, 3> _values;
+	std::atomic<int> _middle = 1;
+	int _back = 0;
+	int _front = 2;
+
+};
+
+template <typename Value>
+Value &FrameMailbox<Value>::back() {
+	return _values[_back];
+}
+
+template <typename Value>
+void FrameMailbox<Value>::publish() {
+	_back = _middle.exchange(_back | kFresh, std::memory_order_acq_rel)
+		& kIndexMask;
+}
+
+template <typename Value>
+bool FrameMailbox<Value>::update() {
+	if (!(_middle.load(std::memory_order_relaxed) & kFresh)) {
+		return false;
+	}
+	_front = _middle.exchange(_front, std::memory_order_acq_rel)
+		& kIndexMask;
+	return true;
+}
+
+template <typename Value>
+Value &FrameMailbox<Value>::front() {
+	return _values[_front];
+}
+
+} // namespace Webrtc::details
@@ -0,0 +1,96 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_memory.h"
+
+#include "webrtc/details/webrtc_frame_storage_pool.h"
+#include "webrtc/webrtc_video_track.h"
+
+#include <crl/crl_on_main.h>
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kDefaultBudget = int64(512 * 1024 * 1024);
+constexpr auto kEvictionInterval = crl::time(1000);
+
+} // namespace
+
+FrameMemory::FrameMemory() : _budget(kDefaultBudget) {
+}
+
+FrameMemory &FrameMemory::Instance() {
+	// Never destroyed, sinks may release frames after static cleanup.
+	static const auto result = new FrameMemory();
+	return *result;
+}
+
+void FrameMemory::add(int64 delta) {
+	_used.fetch_add(delta, std::memory_order_relaxed);
+	if (delta <= 0
+		|| crl::now() < _nextEviction.load(std::memory_order_relaxed)
+		|| !overBudget()
+		|| _evictionScheduled.exchange(true)) {
+		return;
+	}
+	crl::on_main([=] {
+		evict();
+	});
+}
+
+bool FrameMemory::overBudget() const {
+	const auto used = _used.load(std::memory_order_relaxed)
+		+ FrameStoragePool::Instance().bytesHeld();
+	return (used > _budget.load(std::memory_order_relaxed));
+}
+
+void FrameMemory::setBudget(int64 bytes) {
+	_budget = std::max(bytes, int64(0));
+	_nextEviction = 0;
+}
+
+VideoMemoryStats FrameMemory::stats() const {
+	return {
+		.bytesUsed = _used.load(std::memory_order_relaxed),
+		.bytesPooled = FrameStoragePool::Instance().bytesHeld(),
+		.bytesBudget = _budget.load(std::memory_order_relaxed),
+		.evictions = _evictions.load(std::memory_order_relaxed),
+		.bytesEvicted = _evicted.load(std::memory_order_relaxed),
+	};
+}
+
+void FrameMemory::registerClient(std::weak_ptr<Client> client) {
+	// Evictions are rare, without them the destroyed clients would keep
+	// their control blocks alive for as long as the process runs.
+	const auto expired = [](const std::weak_ptr<Client> &client) {
+		return client.expired();
+	};
+	_clients.erase(ranges::remove_if(_clients, expired), end(_clients));
+	_clients.push_back(std::move(client));
+}
+
+void FrameMemory::evict() {
+	const auto now = crl::now();
+	_nextEviction = now + kEvictionInterval;
+	_evictionScheduled = false;
+	if (!overBudget()) {
+		return;
+	}
+	auto freed = FrameStoragePool::Instance().bytesHeld();
+	FrameStoragePool::Instance().clear();
+	for (auto i = begin(_clients); i != end(_clients);) {
+		if (const auto strong = i->lock()) {
+			freed += strong->evict(now);
+			++i;
+		} else {
+			i = _clients.erase(i);
+		}
+	}
+	_evictions.fetch_add(1, std::memory_order_relaxed);
+	_evicted.fetch_add(freed, std::memory_order_relaxed);
+}
+
+} // namespace Webrtc::details
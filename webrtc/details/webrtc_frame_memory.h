@@ -0,0 +1,65 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <crl/crl_time.h>
+
+#include <atomic>
+
+namespace Webrtc {
+struct VideoMemoryStats;
+} // namespace Webrtc
+
+namespace Webrtc::details {
+
+// Process-wide accounting of the memory held by the frames of all tracks.
+//
+// Sinks report changes of the bytes held by their frames. When the total,
+// together with the idle storages of FrameStoragePool, gets over the
+// budget, the pool is emptied and all the clients are asked on the main
+// thread to release what they can, not more often than once a second.
+class FrameMemory final {
+public:
+	class Client {
+	public:
+		// Called from the main thread, returns the number of bytes freed.
+		virtual int64 evict(crl::time now) = 0;
+
+	protected:
+		~Client() = default;
+
+	};
+
+	[[nodiscard]] static FrameMemory &Instance();
+
+	// Called from any thread.
+	void add(int64 delta);
+	[[nodiscard]] bool overBudget() const;
+	void setBudget(int64 bytes);
+	[[nodiscard]] VideoMemoryStats stats() const;
+
+	// Called from the main thread.
+	void registerClient(std::weak_ptr<Client> client);
+
+private:
+	FrameMemory();
+
+	void evict();
+
+	std::atomic<int64> _used = 0;
+	std::atomic<int64> _budget = 0;
+	std::atomic<int64> _evictions = 0;
+	std::atomic<int64> _evicted = 0;
+	std::atomic<crl::time> _nextEviction = 0;
+	std::atomic<bool> _evictionScheduled = false;
+
+	// Main thread.
+	std::vector<std::weak_ptr<Client>> _clients;
+
+};
+
+} // namespace Webrtc::details
@@ -0,0 +1,103 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_notifier.h"
+
+#include "base/timer.h"
+
+#include <crl/crl_on_main.h>
+
+namespace Webrtc::details {
+namespace {
+
+// Don't wait for a tick that is this close, deliver right away.
+constexpr auto kTickTolerance = crl::time(2);
+
+} // namespace
+
+FrameNotifier::FrameNotifier() = default;
+
+FrameNotifier &FrameNotifier::Instance() {
+	// Never destroyed, sinks may publish frames after static cleanup.
+	static const auto result = new FrameNotifier();
+	return *result;
+}
+
+void FrameNotifier::notify(const std::shared_ptr<Client> &client) {
+	if (client->_queued.exchange(true)) {
+		// Already waiting for the next batch.
+		return;
+	}
+	{
+		auto lock = QMutexLocker(&_mutex);
+		_queued.push_back(client);
+	}
+	if (!_scheduled.exchange(true)) {
+		crl::on_main([=] {
+			schedule();
+		});
+	}
+}
+
+void FrameNotifier::setTickInterval(crl::time interval) {
+	Expects(interval >= 0);
+
+	_tickInterval = interval;
+	if (!_tickInterval && _tickTimer && _tickTimer->isActive()) {
+		_tickTimer->cancel();
+		deliver();
+	}
+}
+
+auto FrameNotifier::batches() const
+-> rpl::producer<std::vector<not_null<Client*>>> {
+	return _batches.events();
+}
+
+void FrameNotifier::schedule() {
+	if (_tickInterval > 0) {
+		const auto wait = _tickInterval - (crl::now() % _tickInterval);
+		if (wait > kTickTolerance && wait < _tickInterval) {
+			if (!_tickTimer) {
+				_tickTimer = std::make_unique<base::Timer>([=] {
+					deliver();
+				});
+			}
+			if (!_tickTimer->isActive()) {
+				_tickTimer->callOnce(wait);
+			}
+			return;
+		}
+	}
+	deliver();
+}
+
+void FrameNotifier::deliver() {
+	// Clients queued after this point post a callback for the next batch.
+	_scheduled = false;
+	{
+		auto lock = QMutexLocker(&_mutex);
+		std::swap(_queued, _delivering);
+	}
+	for (const auto &weak : _delivering) {
+		if (auto strong = weak.lock()) {
+			strong->_queued = false;
+			_batch.push_back(strong.get());
+			_alive.push_back(std::move(strong));
+		}
+	}
+	_delivering.clear();
+	for (const auto client : _batch) {
+		client->framesReady();
+	}
+	if (!_batch.empty()) {
+		_batches.fire_copy(_batch);
+	}
+	_batch.clear();
+	_alive.clear();
+}
+
+} // namespace Webrtc::details
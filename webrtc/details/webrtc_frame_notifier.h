@@ -0,0 +1,76 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <crl/crl_time.h>
+#include <rpl/event_stream.h>
+#include <QtCore/QMutex>
+
+#include <atomic>
+
+namespace base {
+class Timer;
+} // namespace base
+
+namespace Webrtc::details {
+
+// Delivers "new frame" notifications of all the tracks to the main thread
+// in batches.
+//
+// A client with a new frame is marked dirty and queued, only the first
+// client queued in a batch posts a main thread callback, which notifies
+// all the queued clients at once. With a tick interval set the callback
+// is delayed until the next multiple of the interval, so that frames of
+// different tracks are repainted together.
+class FrameNotifier final {
+public:
+	class Client {
+	public:
+		// Called from the main thread.
+		virtual void framesReady() = 0;
+
+	protected:
+		~Client() = default;
+
+	private:
+		friend class FrameNotifier;
+
+		std::atomic<bool> _queued = false;
+
+	};
+
+	[[nodiscard]] static FrameNotifier &Instance();
+
+	// Called from any thread.
+	void notify(const std::shared_ptr<Client> &client);
+
+	// Called from the main thread.
+	void setTickInterval(crl::time interval);
+	[[nodiscard]] auto batches() const
+	-> rpl::producer<std::vector<not_null<Client*>>>;
+
+private:
+	FrameNotifier();
+
+	void schedule();
+	void deliver();
+
+	QMutex _mutex;
+	std::vector<std::weak_ptr<Client>> _queued;
+	std::atomic<bool> _scheduled = false;
+
+	// Main thread.
+	std::vector<std::weak_ptr<Client>> _delivering;
+	std::vector<std::shared_ptr<Client>> _alive;
+	std::vector<not_null<Client*>> _batch;
+	rpl::event_stream<std::vector<not_null<Client*>>> _batches;
+	std::unique_ptr<base::Timer> _tickTimer;
+	crl::time _tickInterval = 0;
+
+};
+
+} // namespace Webrtc::details
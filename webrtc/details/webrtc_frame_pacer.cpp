@@ -0,0 +1,76 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_pacer.h"
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kWindowFrames = 64;
+constexpr auto kJitterMultiplier = 3;
+
+// Larger transit changes mean the stream was restarted or the clock jumped.
+constexpr auto kResetTransitChange = int64(5'000'000);
+
+} // namespace
+
+FramePacer::FramePacer(crl::time latencyBudget)
+: _latencyBudget(std::max(latencyBudget, crl::time(0)) * 1000) {
+}
+
+void FramePacer::arrived(int64 timestamp, crl::profile_time arrival) {
+	auto lock = QMutexLocker(&_mutex);
+	const auto transit = arrival - timestamp;
+	if (_started) {
+		const auto difference = std::abs(transit - _lastTransit);
+		if (difference > kResetTransitChange) {
+			_started = _hasPrevious = false;
+			_windowFrames = 0;
+			_jitter = 0;
+		} else {
+			_jitter += (difference - _jitter) / 16;
+		}
+	}
+	_started = true;
+	_lastTransit = transit;
+	_windowMin = _windowFrames ? std::min(_windowMin, transit) : transit;
+	if (++_windowFrames == kWindowFrames) {
+		_previousMin = _windowMin;
+		_hasPrevious = true;
+		_windowFrames = 0;
+	}
+}
+
+int64 FramePacer::baseTransit() const {
+	if (!_windowFrames) {
+		return _hasPrevious ? _previousMin : _lastTransit;
+	}
+	return _hasPrevious ? std::min(_previousMin, _windowMin) : _windowMin;
+}
+
+int64 FramePacer::computeTargetDelay() const {
+	return std::min(_jitter * kJitterMultiplier, _latencyBudget);
+}
+
+crl::profile_time FramePacer::due(int64 timestamp) const {
+	auto lock = QMutexLocker(&_mutex);
+	if (!_started) {
+		return 0;
+	}
+	return timestamp + baseTransit() + computeTargetDelay();
+}
+
+int64 FramePacer::jitter() const {
+	auto lock = QMutexLocker(&_mutex);
+	return _jitter;
+}
+
+int64 FramePacer::targetDelay() const {
+	auto lock = QMutexLocker(&_mutex);
+	return computeTargetDelay();
+}
+
+} // namespace Webrtc::details
@@ -0,0 +1,50 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <crl/crl_time.h>
+#include <QtCore/QMutex>
+
+namespace Webrtc::details {
+
+// Maps frame timestamps to the playout clock for paced presentation.
+//
+// The smallest transit time (arrival minus timestamp) over the last
+// couple of windows of frames is taken as the base, frames are shown at
+// their timestamp plus the base plus a delay that absorbs the jitter,
+// estimated as in RFC 3550, limited by the latency budget.
+// All the times are in microseconds.
+class FramePacer final {
+public:
+	explicit FramePacer(crl::time latencyBudget);
+
+	// Called from the producer thread.
+	void arrived(int64 timestamp, crl::profile_time arrival);
+
+	// Called from any thread.
+	[[nodiscard]] crl::profile_time due(int64 timestamp) const;
+	[[nodiscard]] int64 jitter() const;
+	[[nodiscard]] int64 targetDelay() const;
+
+private:
+	[[nodiscard]] int64 baseTransit() const;
+	[[nodiscard]] int64 computeTargetDelay() const;
+
+	const int64 _latencyBudget = 0;
+
+	mutable QMutex _mutex;
+	int64 _lastTransit = 0;
+	int64 _jitter = 0;
+	int64 _windowMin = 0;
+	int64 _previousMin = 0;
+	int _windowFrames = 0;
+	bool _hasPrevious = false;
+	bool _started = false;
+
+};
+
+} // namespace Webrtc::details
@@ -0,0 +1,138 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_rounding.h"
+
+#include <QtCore/QMutex>
+#include <QtGui/QImage>
+
+#include <cmath>
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kMaxCachedMasks = 8;
+
+struct CornerMask {
+	int radius = 0;
+
+	// Rows of the top-left corner, and the same rows mirrored.
+	std::vector<uint8> left;
+	std::vector<uint8> right;
+};
+
+class CornerMasks final {
+public:
+	[[nodiscard]] std::shared_ptr<const CornerMask> get(int radius);
+
+private:
+	[[nodiscard]] static CornerMask Generate(int radius);
+
+	QMutex _mutex;
+
+	// Most recently used last.
+	std::vector<std::shared_ptr<const CornerMask>> _masks;
+
+};
+
+std::shared_ptr<const CornerMask> CornerMasks::get(int radius) {
+	auto lock = QMutexLocker(&_mutex);
+	const auto i = ranges::find(
+		_masks,
+		radius,
+		[](const std::shared_ptr<const CornerMask> &mask) {
+			return mask->radius;
+		});
+	if (i != end(_masks)) {
+		std::rotate(i, i + 1, end(_masks));
+		return _masks.back();
+	}
+	lock.unlock();
+
+	auto generated = std::make_shared<const CornerMask>(Generate(radius));
+
+	lock.relock();
+	if (_masks.size() == kMaxCachedMasks) {
+		_masks.erase(begin(_masks));
+	}
+	_masks.push_back(generated);
+	return generated;
+}
+
+CornerMask CornerMasks::Generate(int radius) {
+	auto result = CornerMask{ .radius = radius };
+	result.left.resize(radius * radius);
+	result.right.resize(radius * radius);
+	for (auto y = 0; y != radius; ++y) {
+		for (auto x = 0; x != radius; ++x) {
+			const auto dx = radius - (x + 0.5);
+			const auto dy = radius - (y + 0.5);
+			const auto coverage = std::clamp(
+				radius - std::sqrt(dx * dx + dy * dy) + 0.5,
+				0.,
+				1.);
+			const auto alpha = uint8(std::round(coverage * 255.));
+			result.left[y * radius + x] = alpha;
+			result.right[y * radius + (radius - 1 - x)] = alpha;
+		}
+	}
+	return result;
+}
+
+[[nodiscard]] CornerMasks &Masks() {
+	static auto result = CornerMasks();
+	return result;
+}
+
+// Plain loop over bytes, auto-vectorized by the compilers we use.
+void MultiplyRow(uint8 *pixels, const uint8 *alpha, int count) {
+	for (auto i = 0; i != count; ++i) {
+		const auto a = uint32(alpha[i]);
+		for (auto c = 0; c != 4; ++c) {
+			const auto value = uint32(pixels[i * 4 + c]) * a + 128;
+			pixels[i * 4 + c] = uint8((value + (value >> 8)) >> 8);
+		}
+	}
+}
+
+} // namespace
+
+void ApplyRounding(QImage &image, int radius, FrameCorners corners) {
+	Expects(image.format() == QImage::Format_ARGB32_Premultiplied);
+
+	radius = std::min({ radius, image.width() / 2, image.height() / 2 });
+	if (radius <= 0 || !(corners & FrameCorner::All)) {
+		return;
+	}
+	const auto mask = Masks().get(radius);
+	const auto width = image.width();
+	const auto height = image.height();
+	const auto stride = image.bytesPerLine();
+	const auto bytes = image.bits();
+	const auto apply = [&](int left, bool top, const std::vector<uint8> &m) {
+		for (auto y = 0; y != radius; ++y) {
+			const auto row = top ? y : (height - 1 - y);
+			MultiplyRow(
+				bytes + row * stride + left * 4,
+				m.data() + y * radius,
+				radius);
+		}
+	};
+	if (corners & FrameCorner::TopLeft) {
+		apply(0, true, mask->left);
+	}
+	if (corners & FrameCorner::TopRight) {
+		apply(width - radius, true, mask->right);
+	}
+	if (corners & FrameCorner::BottomLeft) {
+		apply(0, false, mask->left);
+	}
+	if (corners & FrameCorner::BottomRight) {
+		apply(width - radius, false, mask->right);
+	}
+}
+
+} // namespace Webrtc::details
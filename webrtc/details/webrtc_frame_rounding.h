@@ -0,0 +1,20 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include "webrtc/webrtc_video_track.h"
+
+namespace Webrtc::details {
+
+// Rounds the corners of a premultiplied ARGB32 image in place.
+//
+// Antialiased corner masks are computed once per radius and kept in a
+// small process-wide cache, only the pixels inside the corner squares
+// are touched.
+void ApplyRounding(QImage &image, int radius, FrameCorners corners);
+
+} // namespace Webrtc::details
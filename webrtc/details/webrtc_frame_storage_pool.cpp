@@ -0,0 +1,127 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_frame_storage_pool.h"
+
+#include "webrtc/webrtc_video_track.h"
+#include "ffmpeg/ffmpeg_utility.h"
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kDefaultLimit = int64(64 * 1024 * 1024);
+
+} // namespace
+
+FrameStoragePool::FrameStoragePool() : _bytesLimit(kDefaultLimit) {
+}
+
+FrameStoragePool &FrameStoragePool::Instance() {
+	// Never destroyed, sinks may release storages after static cleanup.
+	static const auto result = new FrameStoragePool();
+	return *result;
+}
+
+int64 FrameStoragePool::ComputeBytes(const QImage &image) {
+	return int64(image.bytesPerLine()) * image.height();
+}
+
+QImage FrameStoragePool::take(QSize size) {
+	Expects(!size.isEmpty());
+
+	{
+		auto lock = QMutexLocker(&_mutex);
+		const auto i = _buckets.find(Key{ size.width(), size.height() });
+		if (i != end(_buckets) && !i->second.empty()) {
+			auto result = std::move(i->second.back().image);
+			i->second.pop_back();
+			_bytesHeld -= ComputeBytes(result);
+			++_hits;
+			return result;
+		}
+		++_misses;
+	}
+	return FFmpeg::CreateFrameStorage(size);
+}
+
+void FrameStoragePool::release(QImage &&image) {
+	auto taken = base::take(image);
+	if (taken.isNull()
+		|| !FFmpeg::GoodStorageForFrame(taken, taken.size())) {
+		// Someone still holds a copy of this image, it can't be reused.
+		return;
+	}
+	const auto size = taken.size();
+	auto lock = QMutexLocker(&_mutex);
+	_bytesHeld += ComputeBytes(taken);
+	_buckets[Key{ size.width(), size.height() }].push_back({
+		.image = std::move(taken),
+		.released = ++_releaseCounter,
+	});
+	evictOverLimit();
+}
+
+void FrameStoragePool::ensure(QImage &storage, QSize size) {
+	if (!FFmpeg::GoodStorageForFrame(storage, size)) {
+		release(std::move(storage));
+		storage = take(size);
+	}
+}
+
+void FrameStoragePool::setLimit(int64 bytes) {
+	auto lock = QMutexLocker(&_mutex);
+	_bytesLimit = std::max(bytes, int64(0));
+	evictOverLimit();
+}
+
+void FrameStoragePool::clear() {
+	auto buckets = base::flat_map<Key, std::vector<Entry>>();
+	{
+		auto lock = QMutexLocker(&_mutex);
+		std::swap(buckets, _buckets);
+		_bytesHeld = 0;
+	}
+	// The storages are freed outside of the lock.
+}
+
+int64 FrameStoragePool::bytesHeld() const {
+	auto lock = QMutexLocker(&_mutex);
+	return _bytesHeld;
+}
+
+void FrameStoragePool::evictOverLimit() {
+	while (_bytesHeld > _bytesLimit) {
+		auto oldest = end(_buckets);
+		for (auto i = begin(_buckets); i != end(_buckets); ++i) {
+			if (!i->second.empty()
+				&& (oldest == end(_buckets)
+					|| (i->second.front().released
+						< oldest->second.front().released))) {
+				oldest = i;
+			}
+		}
+		Assert(oldest != end(_buckets));
+
+		auto &entries = oldest->second;
+		_bytesHeld -= ComputeBytes(entries.front().image);
+		entries.erase(begin(entries));
+		if (entries.empty()) {
+			_buckets.erase(oldest);
+		}
+	}
+}
+
+FrameStorageStats FrameStoragePool::stats() const {
+	auto lock = QMutexLocker(&_mutex);
+	return {
+		.hits = _hits,
+		.misses = _misses,
+		.bytesHeld = _bytesHeld,
+		.bytesLimit = _bytesLimit,
+	};
+}
+
+} // namespace Webrtc::details
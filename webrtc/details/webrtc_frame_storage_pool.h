@@ -0,0 +1,63 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+namespace Webrtc {
+struct FrameStorageStats;
+} // namespace Webrtc
+
+namespace Webrtc::details {
+
+// Process-wide cache of ARGB32 frame storages, bucketed by frame size.
+//
+// Frame storages released by one track are reused by any other track
+// (or by the same track after a resolution switch), the total amount of
+// memory held by the pool is limited, the least recently released
+// storages are freed first.
+class FrameStoragePool final {
+public:
+	[[nodiscard]] static FrameStoragePool &Instance();
+
+	// Called from any thread.
+	[[nodiscard]] QImage take(QSize size);
+	void release(QImage &&image);
+
+	// Helper for `if (!good(storage, size)) storage = take(size)`.
+	void ensure(QImage &storage, QSize size);
+
+	void setLimit(int64 bytes);
+	void clear();
+	[[nodiscard]] int64 bytesHeld() const;
+	[[nodiscard]] FrameStorageStats stats() const;
+
+private:
+	struct Entry {
+		QImage image;
+		uint64 released = 0;
+	};
+	using Key = std::pair<int, int>;
+
+	FrameStoragePool();
+
+	[[nodiscard]] static int64 ComputeBytes(const QImage &image);
+	void evictOverLimit();
+
+	mutable QMutex _mutex;
+	base::flat_map<Key, std::vector<Entry>> _buckets;
+	uint64 _releaseCounter = 0;
+	int64 _bytesHeld = 0;
+	int64 _bytesLimit = 0;
+	int64 _hits = 0;
+	int64 _misses = 0;
+
+};
+
+} // namespace Webrtc::details
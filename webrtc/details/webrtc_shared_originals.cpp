@@ -0,0 +1,63 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_shared_originals.h"
+
+#include "webrtc/details/webrtc_frame_storage_pool.h"
+
+#include <api/video/video_frame_buffer.h>
+
+namespace Webrtc::details {
+namespace {
+
+// Tracks converting on their own threads may be a frame behind.
+constexpr auto kEntries = 2;
+
+} // namespace
+
+struct SharedOriginals::Entry {
+	rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+	QImage original;
+};
+
+SharedOriginals::SharedOriginals() : _entries(kEntries) {
+}
+
+SharedOriginals::~SharedOriginals() {
+	clear();
+}
+
+QImage SharedOriginals::original(
+		not_null<webrtc::VideoFrameBuffer*> buffer,
+		Fn<void(QImage &storage)> convert) {
+	// Tracks wait here for the one converting the same buffer.
+	auto lock = QMutexLocker(&_mutex);
+	auto i = ranges::find(_entries, buffer.get(), [](const Entry &entry) {
+		return entry.buffer.get();
+	});
+	if (i == end(_entries)) {
+		// Replace the least recently used entry, the last one.
+		i = end(_entries) - 1;
+		i->buffer = rtc::scoped_refptr<webrtc::VideoFrameBuffer>(
+			buffer.get());
+		convert(i->original);
+	}
+
+	// The most recently used entry goes first.
+	ranges::rotate(begin(_entries), i, i + 1);
+	return _entries.front().original;
+}
+
+void SharedOriginals::clear() {
+	auto lock = QMutexLocker(&_mutex);
+	auto &pool = FrameStoragePool::Instance();
+	for (auto &entry : _entries) {
+		entry.buffer = nullptr;
+		pool.release(std::move(entry.original));
+	}
+}
+
+} // namespace Webrtc::details
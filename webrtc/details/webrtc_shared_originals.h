@@ -0,0 +1,45 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <QtCore/QMutex>
+#include <QtGui/QImage>
+
+namespace webrtc {
+class VideoFrameBuffer;
+} // namespace webrtc
+
+namespace Webrtc::details {
+
+// ARGB32 originals of the latest buffers delivered to several tracks
+// by one VideoFanOut, so that each buffer is converted only once.
+//
+// The buffers are held together with their originals, so an address
+// is never reused for another buffer while it is cached. The originals
+// are shared by the tracks and must not be modified.
+class SharedOriginals final {
+public:
+	SharedOriginals();
+	~SharedOriginals();
+
+	// Called from any thread. Returns the original of the buffer, calling
+	// `convert` to fill it if no track has converted this buffer yet.
+	[[nodiscard]] QImage original(
+		not_null<webrtc::VideoFrameBuffer*> buffer,
+		Fn<void(QImage &storage)> convert);
+
+	void clear();
+
+private:
+	struct Entry;
+
+	QMutex _mutex;
+	std::vector<Entry> _entries;
+
+};
+
+} // namespace Webrtc::details
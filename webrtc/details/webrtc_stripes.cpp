@@ -0,0 +1,82 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_stripes.h"
+
+#include <crl/crl_async.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kMaxStripes = 8;
+
+struct Stripes {
+	Fn<void(int)> method;
+	int count = 0;
+	std::atomic<int> next = 0;
+	std::atomic<int> finished = 0;
+	std::mutex mutex;
+	std::condition_variable done;
+};
+
+// Returns true if the last stripe was finished by this call.
+bool ProcessStripes(Stripes &stripes) {
+	auto last = false;
+	while (true) {
+		const auto index = stripes.next.fetch_add(1);
+		if (index >= stripes.count) {
+			return last;
+		}
+		stripes.method(index);
+		last = (stripes.finished.fetch_add(1) + 1 == stripes.count);
+	}
+}
+
+} // namespace
+
+void RunInStripes(int count, Fn<void(int)> method) {
+	if (count <= 1) {
+		if (count == 1) {
+			method(0);
+		}
+		return;
+	}
+	const auto stripes = std::make_shared<Stripes>();
+	stripes->method = std::move(method);
+	stripes->count = count;
+	for (auto i = 1; i != count; ++i) {
+		// Tasks starting after everything is claimed exit right away,
+		// they keep only the shared state alive, not the caller data.
+		crl::async([=] {
+			if (ProcessStripes(*stripes)) {
+				auto lock = std::unique_lock(stripes->mutex);
+				stripes->done.notify_one();
+			}
+		});
+	}
+	if (ProcessStripes(*stripes)) {
+		return;
+	}
+	auto lock = std::unique_lock(stripes->mutex);
+	stripes->done.wait(lock, [&] {
+		return (stripes->finished.load() == stripes->count);
+	});
+}
+
+int MaxStripesCount() {
+	static const auto result = std::clamp(
+		int(std::thread::hardware_concurrency()),
+		1,
+		kMaxStripes);
+	return result;
+}
+
+} // namespace Webrtc::details
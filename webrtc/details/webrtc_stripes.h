@@ -0,0 +1,22 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+namespace Webrtc::details {
+
+// Calls `method(index)` for each index in [0, count), on the shared
+// thread pool and on the calling thread, and returns when all are done.
+//
+// Indices are claimed one by one by whoever is free, the calling thread
+// included, so the work is finished even if the pool is busy and none
+// of the pool tasks gets to run in time.
+void RunInStripes(int count, Fn<void(int)> method);
+
+// Number of threads worth splitting the work to on this machine.
+[[nodiscard]] int MaxStripesCount();
+
+} // namespace Webrtc::details
@@ -0,0 +1,686 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_video_convert.h"
+
+#include "webrtc/details/webrtc_stripes.h"
+#include "webrtc/webrtc_video_track.h"
+
+#include <QtGui/QImage>
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+#include <libyuv/convert_argb.h>
+#include <libyuv/planar_functions.h>
+#include <libyuv/rotate.h>
+#include <libyuv/scale.h>
+#include <libyuv/scale_argb.h>
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kBlack = uint32(0xFF000000U);
+
+// One thread converts 1440p I420 to ARGB32 in about 2ms and 4K in about 6ms,
+// while dispatching the stripes costs around 10us. Only frames that take
+// a noticeable part of a 60fps frame interval are worth the pool threads,
+// which are shared with the decoders.
+constexpr auto kStripesMinPixels = 3840 * 2160;
+constexpr auto kStripeMinRows = 128;
+
+// Several variants of different sizes are prepared from each frame,
+// so a smaller request alone doesn't mean the frames got smaller.
+constexpr auto kShrinkScratchAfter = 300;
+
+// Intermediate buffer, its content is always overwritten before reading,
+// so it is never initialized.
+class ScratchBuffer final {
+public:
+	[[nodiscard]] uint8 *prepare(std::size_t bytes);
+
+private:
+	std::unique_ptr<uint8[]> _data;
+	std::size_t _capacity = 0;
+	int _smallerCount = 0;
+
+};
+
+class ScratchYUV420 final {
+public:
+	[[nodiscard]] FrameYUV420 prepare(QSize size);
+
+private:
+	ScratchBuffer _buffer;
+
+};
+
+class ScratchNV12 final {
+public:
+	[[nodiscard]] FrameNV12 prepare(QSize size);
+
+private:
+	ScratchBuffer _buffer;
+
+};
+
+uint8 *ScratchBuffer::prepare(std::size_t bytes) {
+	if (bytes > _capacity) {
+		_smallerCount = 0;
+	} else if (2 * bytes >= _capacity) {
+		_smallerCount = 0;
+		return _data.get();
+	} else if (++_smallerCount < kShrinkScratchAfter) {
+		return _data.get();
+	} else {
+		// Only much smaller buffers were needed for a while, free memory.
+		_smallerCount = 0;
+	}
+	_data = nullptr;
+	_data = std::unique_ptr<uint8[]>(new uint8[bytes]);
+	_capacity = bytes;
+	return _data.get();
+}
+
+FrameYUV420 ScratchYUV420::prepare(QSize size) {
+	const auto chroma = QSize(
+		(size.width() + 1) / 2,
+		(size.height() + 1) / 2);
+	const auto lumaBytes = size.width() * size.height();
+	const auto chromaBytes = chroma.width() * chroma.height();
+	const auto data = _buffer.prepare(
+		std::size_t(lumaBytes + 2 * chromaBytes));
+	return {
+		.size = size,
+		.chromaSize = chroma,
+		.y = { data, size.width() },
+		.u = { data + lumaBytes, chroma.width() },
+		.v = { data + lumaBytes + chromaBytes, chroma.width() },
+	};
+}
+
+FrameNV12 ScratchNV12::prepare(QSize size) {
+	const auto chroma = QSize(
+		(size.width() + 1) / 2,
+		(size.height() + 1) / 2);
+	const auto lumaBytes = size.width() * size.height();
+	const auto data = _buffer.prepare(
+		std::size_t(lumaBytes + 2 * chroma.width() * chroma.height()));
+	return {
+		.size = size,
+		.chromaSize = chroma,
+		.y = { data, size.width() },
+		.uv = { data + lumaBytes, 2 * chroma.width() },
+	};
+}
+
+[[nodiscard]] const uint8 *Plane(const FrameChannel &channel) {
+	return static_cast<const uint8*>(channel.data);
+}
+
+[[nodiscard]] uint8 *MutablePlane(const FrameChannel &channel) {
+	return static_cast<uint8*>(const_cast<void*>(channel.data));
+}
+
+[[nodiscard]] FrameYUV420 Cropped(const FrameYUV420 &from, QRect rect) {
+	Expects(!(rect.x() % 2) && !(rect.y() % 2));
+
+	const auto offset = [](const FrameChannel &channel, int x, int y) {
+		return FrameChannel{
+			.data = Plane(channel) + y * channel.stride + x,
+			.stride = channel.stride,
+		};
+	};
+	return {
+		.size = rect.size(),
+		.chromaSize = { (rect.width() + 1) / 2, (rect.height() + 1) / 2 },
+		.y = offset(from.y, rect.x(), rect.y()),
+		.u = offset(from.u, rect.x() / 2, rect.y() / 2),
+		.v = offset(from.v, rect.x() / 2, rect.y() / 2),
+	};
+}
+
+[[nodiscard]] FrameNV12 Cropped(const FrameNV12 &from, QRect rect) {
+	Expects(!(rect.x() % 2) && !(rect.y() % 2));
+
+	return {
+		.size = rect.size(),
+		.chromaSize = { (rect.width() + 1) / 2, (rect.height() + 1) / 2 },
+		.y = {
+			.data = (Plane(from.y)
+				+ rect.y() * from.y.stride
+				+ rect.x()),
+			.stride = from.y.stride,
+		},
+		.uv = {
+			.data = (Plane(from.uv)
+				+ (rect.y() / 2) * from.uv.stride
+				+ rect.x()),
+			.stride = from.uv.stride,
+		},
+	};
+}
+
+// Extends the rect to even coordinates, within the frame of `size`.
+[[nodiscard]] QRect AlignedToChroma(QRect rect, QSize size) {
+	const auto left = std::max(rect.x(), 0) & ~1;
+	const auto top = std::max(rect.y(), 0) & ~1;
+	const auto right = std::min(
+		(rect.x() + rect.width() + 1) & ~1,
+		size.width());
+	const auto bottom = std::min(
+		(rect.y() + rect.height() + 1) & ~1,
+		size.height());
+	return QRect(left, top, right - left, bottom - top);
+}
+
+// Maps a rectangle in the displayed (rotated) frame of `size`
+// to the same rectangle in the frame before rotation.
+[[nodiscard]] QRect Unrotated(QRect rect, QSize size, int rotation) {
+	switch (rotation) {
+	case 0: return rect;
+	case 90: return QRect(
+		rect.y(),
+		size.width() - rect.x() - rect.width(),
+		rect.height(),
+		rect.width());
+	case 180: return QRect(
+		size.width() - rect.x() - rect.width(),
+		size.height() - rect.y() - rect.height(),
+		rect.width(),
+		rect.height());
+	case 270: return QRect(
+		size.height() - rect.y() - rect.height(),
+		rect.x(),
+		rect.height(),
+		rect.width());
+	}
+	Unexpected("Rotation in Unrotated.");
+}
+
+// Maps `part` of the `full`-sized target to an even-aligned rectangle
+// of the `source`-sized frame, from which it should be scaled.
+[[nodiscard]] QRect SourceRect(QRect part, QSize full, QSize source) {
+	const auto map = [](int value, int from, int to, bool ceil) {
+		const auto scaled = int64(value) * to;
+		return int((scaled + (ceil ? (from - 1) : 0)) / from);
+	};
+	const auto left = map(part.x(), full.width(), source.width(), false)
+		& ~1;
+	const auto top = map(part.y(), full.height(), source.height(), false)
+		& ~1;
+	const auto right = std::min(
+		map(
+			part.x() + part.width(),
+			full.width(),
+			source.width(),
+			true),
+		source.width());
+	const auto bottom = std::min(
+		map(
+			part.y() + part.height(),
+			full.height(),
+			source.height(),
+			true),
+		source.height());
+	return QRect(left, top, right - left, bottom - top);
+}
+
+[[nodiscard]] libyuv::FilterMode Filter(FrameQuality quality) {
+	switch (quality) {
+	case FrameQuality::Fast: return libyuv::kFilterNone;
+	case FrameQuality::Bilinear: return libyuv::kFilterBilinear;
+	case FrameQuality::High: return libyuv::kFilterBox;
+	}
+	Unexpected("Quality in Filter.");
+}
+
+[[nodiscard]] bool Scale(
+		const FrameYUV420 &from,
+		const FrameYUV420 &to,
+		FrameQuality quality) {
+	return !libyuv::I420Scale(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.u),
+		from.u.stride,
+		Plane(from.v),
+		from.v.stride,
+		from.size.width(),
+		from.size.height(),
+		MutablePlane(to.y),
+		to.y.stride,
+		MutablePlane(to.u),
+		to.u.stride,
+		MutablePlane(to.v),
+		to.v.stride,
+		to.size.width(),
+		to.size.height(),
+		Filter(quality));
+}
+
+[[nodiscard]] bool Rotate(
+		const FrameYUV420 &from,
+		const FrameYUV420 &to,
+		int rotation) {
+	const auto mode = [&] {
+		switch (rotation) {
+		case 90: return libyuv::kRotate90;
+		case 180: return libyuv::kRotate180;
+		case 270: return libyuv::kRotate270;
+		}
+		Unexpected("Rotation in Rotate.");
+	}();
+	return !libyuv::I420Rotate(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.u),
+		from.u.stride,
+		Plane(from.v),
+		from.v.stride,
+		MutablePlane(to.y),
+		to.y.stride,
+		MutablePlane(to.u),
+		to.u.stride,
+		MutablePlane(to.v),
+		to.v.stride,
+		from.size.width(),
+		from.size.height(),
+		mode);
+}
+
+[[nodiscard]] bool Scale(
+		const FrameNV12 &from,
+		const FrameNV12 &to,
+		FrameQuality quality) {
+	return !libyuv::NV12Scale(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.uv),
+		from.uv.stride,
+		from.size.width(),
+		from.size.height(),
+		MutablePlane(to.y),
+		to.y.stride,
+		MutablePlane(to.uv),
+		to.uv.stride,
+		to.size.width(),
+		to.size.height(),
+		Filter(quality));
+}
+
+// Rotating splits the chroma planes, the result is YUV420.
+[[nodiscard]] bool Rotate(
+		const FrameNV12 &from,
+		const FrameYUV420 &to,
+		int rotation) {
+	const auto mode = [&] {
+		switch (rotation) {
+		case 90: return libyuv::kRotate90;
+		case 180: return libyuv::kRotate180;
+		case 270: return libyuv::kRotate270;
+		}
+		Unexpected("Rotation in Rotate.");
+	}();
+	return !libyuv::NV12ToI420Rotate(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.uv),
+		from.uv.stride,
+		MutablePlane(to.y),
+		to.y.stride,
+		MutablePlane(to.u),
+		to.u.stride,
+		MutablePlane(to.v),
+		to.v.stride,
+		from.size.width(),
+		from.size.height(),
+		mode);
+}
+
+[[nodiscard]] FrameYUV420 Rows(const FrameYUV420 &from, int top, int rows) {
+	return Cropped(from, QRect(0, top, from.size.width(), rows));
+}
+
+[[nodiscard]] FrameNV12 Rows(const FrameNV12 &from, int top, int rows) {
+	Expects(!(top % 2));
+
+	return {
+		.size = { from.size.width(), rows },
+		.chromaSize = { from.chromaSize.width(), (rows + 1) / 2 },
+		.y = {
+			.data = Plane(from.y) + top * from.y.stride,
+			.stride = from.y.stride,
+		},
+		.uv = {
+			.data = Plane(from.uv) + (top / 2) * from.uv.stride,
+			.stride = from.uv.stride,
+		},
+	};
+}
+
+[[nodiscard]] bool Convert(const FrameYUV420 &from, uchar *to, int stride) {
+	// libyuv "ARGB" is B, G, R, A in memory, which is what both
+	// QImage::Format_ARGB32* and AV_PIX_FMT_BGRA are on little endian.
+	return !libyuv::I420ToARGB(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.u),
+		from.u.stride,
+		Plane(from.v),
+		from.v.stride,
+		to,
+		stride,
+		from.size.width(),
+		from.size.height());
+}
+
+[[nodiscard]] bool Convert(const FrameNV12 &from, uchar *to, int stride) {
+	return !libyuv::NV12ToARGB(
+		Plane(from.y),
+		from.y.stride,
+		Plane(from.uv),
+		from.uv.stride,
+		to,
+		stride,
+		from.size.width(),
+		from.size.height());
+}
+
+[[nodiscard]] int StripesCount(QSize size) {
+	if (size.width() * size.height() < kStripesMinPixels) {
+		return 1;
+	}
+	return std::clamp(
+		size.height() / kStripeMinRows,
+		1,
+		MaxStripesCount());
+}
+
+template <typename Planes>
+[[nodiscard]] bool ConvertAt(
+		const Planes &from,
+		QImage &to,
+		QPoint position) {
+	Expects(QRect(position, from.size).intersected(to.rect())
+		== QRect(position, from.size));
+	Expects(to.depth() == 32);
+
+	const auto stride = int(to.bytesPerLine());
+	const auto data = to.bits() + position.y() * stride + position.x() * 4;
+	const auto stripes = StripesCount(from.size);
+	if (stripes == 1) {
+		return Convert(from, data, stride);
+	}
+
+	// Large frames are converted in horizontal stripes of even height,
+	// so that each stripe starts at its own chroma row.
+	const auto height = from.size.height();
+	const auto rows = ((height + stripes - 1) / stripes + 1) & ~1;
+	auto failed = std::atomic<bool>(false);
+	RunInStripes(stripes, [&](int index) {
+		const auto top = index * rows;
+		const auto count = std::min(rows, height - top);
+		if (count > 0
+			&& !Convert(Rows(from, top, count), data + top * stride, stride)) {
+			failed = true;
+		}
+	});
+	return !failed;
+}
+
+void FillBlack(QImage &to, QRect rect) {
+	if (rect.isEmpty()) {
+		return;
+	}
+	libyuv::ARGBRect(
+		to.bits(),
+		int(to.bytesPerLine()),
+		rect.x(),
+		rect.y(),
+		rect.width(),
+		rect.height(),
+		kBlack);
+}
+
+void FillOuter(QImage &to, QRect inner) {
+	const auto outer = to.rect();
+	if (inner.isEmpty()) {
+		FillBlack(to, outer);
+		return;
+	}
+	const auto left = inner.x();
+	const auto right = outer.width() - inner.width() - left;
+	const auto top = inner.y();
+	const auto bottom = outer.height() - inner.height() - top;
+	FillBlack(to, { 0, 0, left, outer.height() });
+	FillBlack(to, { left + inner.width(), 0, right, outer.height() });
+	FillBlack(to, { left, 0, inner.width(), top });
+	FillBlack(to, { left, top + inner.height(), inner.width(), bottom });
+}
+
+template <typename Planes>
+[[nodiscard]] bool ConvertScaledAt(
+		const Planes &from,
+		QImage &to,
+		QRect inner,
+		int rotation,
+		FrameQuality quality) {
+	Expects(to.depth() == 32);
+
+	const auto visible = inner.intersected(to.rect());
+	FillOuter(to, visible);
+	if (visible.isEmpty()) {
+		return true;
+	}
+	const auto turned = (rotation == 90 || rotation == 270);
+	const auto full = turned ? inner.size().transposed() : inner.size();
+	const auto part = Unrotated(
+		visible.translated(-inner.topLeft()),
+		inner.size(),
+		rotation);
+	const auto source = SourceRect(part, full, from.size);
+	if (source.isEmpty()) {
+		FillBlack(to, visible);
+		return true;
+	}
+	const auto cropped = (source.size() == from.size)
+		? from
+		: Cropped(from, source);
+	if (!rotation && cropped.size == visible.size()) {
+		return ConvertAt(cropped, to, visible.topLeft());
+	}
+
+	// Planes are scaled as they are and converted to YUV420 only if they
+	// need to be rotated, all at the destination resolution.
+	using Scratch = std::conditional_t<
+		std::is_same_v<Planes, FrameNV12>,
+		ScratchNV12,
+		ScratchYUV420>;
+	thread_local auto scaledStorage = Scratch();
+	thread_local auto rotatedStorage = ScratchYUV420();
+
+	auto scaled = cropped;
+	if (cropped.size != part.size()) {
+		scaled = scaledStorage.prepare(part.size());
+		if (!Scale(cropped, scaled, quality)) {
+			return false;
+		}
+	}
+	if (!rotation) {
+		return ConvertAt(scaled, to, visible.topLeft());
+	}
+	const auto rotated = rotatedStorage.prepare(visible.size());
+	return Rotate(scaled, rotated, rotation)
+		&& ConvertAt(rotated, to, visible.topLeft());
+}
+
+} // namespace
+
+bool ConvertToARGB32(const FrameYUV420 &from, QImage &to) {
+	Expects(to.size() == from.size);
+
+	return ConvertAt(from, to, QPoint());
+}
+
+bool ConvertToARGB32(const FrameNV12 &from, QImage &to) {
+	Expects(to.size() == from.size);
+
+	return ConvertAt(from, to, QPoint());
+}
+
+bool ConvertToARGB32(
+		const FrameYUV420 &from,
+		QImage &to,
+		QRect inner,
+		int rotation,
+		FrameQuality quality) {
+	return ConvertScaledAt(from, to, inner, rotation, quality);
+}
+
+bool ConvertToARGB32(
+		const FrameNV12 &from,
+		QImage &to,
+		QRect inner,
+		int rotation,
+		FrameQuality quality) {
+	return ConvertScaledAt(from, to, inner, rotation, quality);
+}
+
+bool ConvertRectToARGB32(
+		const FrameYUV420 &from,
+		QImage &to,
+		QRect rect) {
+	Expects(to.size() == from.size);
+
+	const auto aligned = AlignedToChroma(rect, from.size);
+	return aligned.isEmpty()
+		|| ConvertAt(Cropped(from, aligned), to, aligned.topLeft());
+}
+
+bool ConvertRectToARGB32(
+		const FrameNV12 &from,
+		QImage &to,
+		QRect rect) {
+	Expects(to.size() == from.size);
+
+	const auto aligned = AlignedToChroma(rect, from.size);
+	return aligned.isEmpty()
+		|| ConvertAt(Cropped(from, aligned), to, aligned.topLeft());
+}
+
+bool ScaleToARGB32(
+		const QImage &from,
+		QImage &to,
+		QRect inner,
+		FrameQuality quality,
+		QRect clip) {
+	Expects(to.rect().contains(inner));
+	Expects(from.depth() == 32 && to.depth() == 32);
+
+	if (clip.isNull()) {
+		FillOuter(to, inner);
+		clip = inner;
+	}
+	clip = clip.intersected(inner);
+	if (clip.isEmpty() || from.isNull()) {
+		return !from.isNull();
+	}
+
+	// The clip is given relative to the full destination, libyuv computes
+	// the source position of each pixel the same way as without the clip.
+	const auto stride = int(to.bytesPerLine());
+	return !libyuv::ARGBScaleClip(
+		from.constBits(),
+		int(from.bytesPerLine()),
+		from.width(),
+		from.height(),
+		to.bits() + inner.y() * stride + inner.x() * 4,
+		stride,
+		inner.width(),
+		inner.height(),
+		clip.x() - inner.x(),
+		clip.y() - inner.y(),
+		clip.width(),
+		clip.height(),
+		Filter(quality));
+}
+
+bool ScaleToARGB32(
+		const QImage &from,
+		QImage &to,
+		QRect inner,
+		int rotation,
+		FrameQuality quality) {
+	Expects(to.rect().contains(inner));
+	Expects(from.depth() == 32 && to.depth() == 32);
+
+	if (!rotation) {
+		return ScaleToARGB32(from, to, inner, quality);
+	}
+	FillOuter(to, inner);
+	if (inner.isEmpty() || from.isNull()) {
+		return !from.isNull();
+	}
+	const auto mode = [&] {
+		switch (rotation) {
+		case 90: return libyuv::kRotate90;
+		case 180: return libyuv::kRotate180;
+		case 270: return libyuv::kRotate270;
+		}
+		Unexpected("Rotation in ScaleToARGB32.");
+	}();
+	const auto turned = (rotation == 90 || rotation == 270);
+	const auto size = turned ? inner.size().transposed() : inner.size();
+
+	// Scale before rotating, so that only the result size is rotated.
+	thread_local auto scaledStorage = ScratchBuffer();
+	auto source = from.constBits();
+	auto sourceStride = int(from.bytesPerLine());
+	if (from.size() != size) {
+		const auto scaledStride = size.width() * 4;
+		const auto scaled = scaledStorage.prepare(
+			std::size_t(scaledStride) * size.height());
+		const auto failed = libyuv::ARGBScale(
+			source,
+			sourceStride,
+			from.width(),
+			from.height(),
+			scaled,
+			scaledStride,
+			size.width(),
+			size.height(),
+			Filter(quality));
+		if (failed) {
+			return false;
+		}
+		source = scaled;
+		sourceStride = scaledStride;
+	}
+	const auto stride = int(to.bytesPerLine());
+	return !libyuv::ARGBRotate(
+		source,
+		sourceStride,
+		to.bits() + inner.y() * stride + inner.x() * 4,
+		stride,
+		size.width(),
+		size.height(),
+		mode);
+}
+
+bool RotateYUV420(
+		const FrameYUV420 &from,
+		const FrameYUV420 &to,
+		int rotation) {
+	Expects(to.size == ((rotation == 90 || rotation == 270)
+		? from.size.transposed()
+		: from.size));
+
+	return Rotate(from, to, rotation);
+}
+
+} // namespace Webrtc::details
@@ -0,0 +1,88 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include <QtCore/QRect>
+
+class QImage;
+
+namespace Webrtc {
+struct FrameYUV420;
+struct FrameNV12;
+enum class FrameQuality : uchar;
+} // namespace Webrtc
+
+namespace Webrtc::details {
+
+// Same-size YUV420 -> ARGB32 conversion.
+//
+// The row kernels (SSE2 / SSSE3 / AVX2 / NEON with a plain C fallback)
+// are selected once at runtime from the CPU features of the machine.
+[[nodiscard]] bool ConvertToARGB32(const FrameYUV420 &from, QImage &to);
+[[nodiscard]] bool ConvertToARGB32(const FrameNV12 &from, QImage &to);
+
+// Scales, rotates and converts a YUV420 frame in one go, so that it
+// fills the `inner` rectangle of `to` (clipped by `to` bounds), and
+// fills everything outside of `inner` with opaque black.
+//
+// Only the visible part of the source planes is read and all the
+// intermediate work is done at the destination resolution, with the
+// libyuv filter (nearest, bilinear or box) matching the `quality`.
+[[nodiscard]] bool ConvertToARGB32(
+	const FrameYUV420 &from,
+	QImage &to,
+	QRect inner,
+	int rotation,
+	FrameQuality quality);
+[[nodiscard]] bool ConvertToARGB32(
+	const FrameNV12 &from,
+	QImage &to,
+	QRect inner,
+	int rotation,
+	FrameQuality quality);
+
+// Same-size conversion of the `rect` part only, the rest of `to` is kept.
+// The rect is extended to even coordinates to cover whole chroma samples.
+[[nodiscard]] bool ConvertRectToARGB32(
+	const FrameYUV420 &from,
+	QImage &to,
+	QRect rect);
+[[nodiscard]] bool ConvertRectToARGB32(
+	const FrameNV12 &from,
+	QImage &to,
+	QRect rect);
+
+// Scales an ARGB32 image so that it fills the `inner` rectangle of `to`.
+//
+// With a null `clip` everything outside of `inner` is filled with opaque
+// black, otherwise only the `clip` part of `inner` is written, with the
+// same pixels the full scale would give, the rest of `to` is kept.
+[[nodiscard]] bool ScaleToARGB32(
+	const QImage &from,
+	QImage &to,
+	QRect inner,
+	FrameQuality quality,
+	QRect clip = QRect());
+
+// Same, but also rotates the image clockwise by `rotation` on the way,
+// `inner` being the rectangle of the rotated image, and always writes
+// the whole `to`, each pixel once.
+[[nodiscard]] bool ScaleToARGB32(
+	const QImage &from,
+	QImage &to,
+	QRect inner,
+	int rotation,
+	FrameQuality quality);
+
+// Rotates the planes clockwise with tiled SIMD transpose kernels,
+// `to` should have the size of `from` rotated by `rotation`.
+[[nodiscard]] bool RotateYUV420(
+	const FrameYUV420 &from,
+	const FrameYUV420 &to,
+	int rotation);
+
+} // namespace Webrtc::details
@@ -0,0 +1,82 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_video_stats.h"
+
+#include <bit>
+#include <cmath>
+
+namespace Webrtc::details {
+namespace {
+
+[[nodiscard]] int BucketIndex(int64 microseconds) {
+	const auto value = uint64(std::max(microseconds, int64(1)));
+	const auto index = int(std::bit_width(value)) - 1;
+	return std::min(index, VideoLatencyStats::kBuckets - 1);
+}
+
+} // namespace
+
+void LatencyHistogram::add(crl::profile_time microseconds) {
+	const auto value = std::max(int64(microseconds), int64(0));
+	_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_sum.fetch_add(value, std::memory_order_relaxed);
+
+	auto max = _max.load(std::memory_order_relaxed);
+	while (max < value
+		&& !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+	}
+}
+
+VideoLatencyStats LatencyHistogram::snapshot() const {
+	// Counters are read one by one, so a snapshot taken while samples
+	// are added may be off by a few samples, which is fine for stats.
+	auto result = VideoLatencyStats();
+	for (auto i = 0; i != VideoLatencyStats::kBuckets; ++i) {
+		result.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+	}
+	result.count = _count.load(std::memory_order_relaxed);
+	result.sum = _sum.load(std::memory_order_relaxed);
+	result.max = _max.load(std::memory_order_relaxed);
+	return result;
+}
+
+} // namespace Webrtc::details
+
+namespace Webrtc {
+
+int64 VideoLatencyStats::average() const {
+	return count ? (sum / count) : 0;
+}
+
+int64 VideoLatencyStats::percentile(float64 fraction) const {
+	auto total = int64(0);
+	for (const auto value : buckets) {
+		total += value;
+	}
+	if (!total) {
+		return 0;
+	}
+	const auto wanted = std::clamp(
+		int64(std::ceil(total * std::clamp(fraction, 0., 1.))),
+		int64(1),
+		total);
+	auto passed = int64(0);
+	for (auto i = 0; i != kBuckets; ++i) {
+		passed += buckets[i];
+		if (passed >= wanted) {
+			// Report the upper bound of the bucket, but never above max.
+			const auto bound = (i + 1 < kBuckets)
+				? ((int64(1) << (i + 1)) - 1)
+				: max;
+			return max ? std::min(bound, max) : bound;
+		}
+	}
+	return max;
+}
+
+} // namespace Webrtc
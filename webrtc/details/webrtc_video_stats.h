@@ -0,0 +1,48 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include "webrtc/webrtc_video_track.h"
+
+#include <crl/crl_time.h>
+#include <atomic>
+
+namespace Webrtc::details {
+
+// Collects latency samples from any thread without locks or allocations.
+class LatencyHistogram final {
+public:
+	void add(crl::profile_time microseconds);
+
+	[[nodiscard]] VideoLatencyStats snapshot() const;
+
+private:
+	std::array<
+		std::atomic<int64>,
+		VideoLatencyStats::kBuckets> _buckets = {};
+	std::atomic<int64> _count = 0;
+	std::atomic<int64> _sum = 0;
+	std::atomic<int64> _max = 0;
+
+};
+
+// Measures the time from its creation until add() is called.
+class LatencyMeasure final {
+public:
+	LatencyMeasure() : _started(crl::profile()) {
+	}
+
+	void add(LatencyHistogram &to) const {
+		to.add(crl::profile() - _started);
+	}
+
+private:
+	crl::profile_time _started = 0;
+
+};
+
+} // namespace Webrtc::details
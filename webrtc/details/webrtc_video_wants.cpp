@@ -0,0 +1,99 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/details/webrtc_video_wants.h"
+
+namespace Webrtc::details {
+namespace {
+
+constexpr auto kWindow = crl::time(500);
+constexpr auto kLowerWindowsToShrink = 4;
+constexpr auto kHigherWindowsToSpeedUp = 8;
+constexpr auto kUnlimited = int64(std::numeric_limits<int>::max());
+
+[[nodiscard]] bool Lower(int64 pixels, int current) {
+	// Don't bother the source with changes by less than a quarter.
+	return (pixels * 4 < int64(current) * 3);
+}
+
+} // namespace
+
+void VideoWantsTracker::requested(
+		int64 pixels,
+		int framerate,
+		crl::time now) {
+	const auto wanted = (pixels > 0)
+		? std::min(pixels, kUnlimited)
+		: kUnlimited;
+	if (!_windowStart) {
+		_windowStart = now;
+	} else if (now - _windowStart >= kWindow) {
+		finishWindow();
+		_windowStart = now;
+	}
+	_windowPeak = std::max(_windowPeak, wanted);
+	_windowFramerate = std::max(
+		_windowFramerate,
+		(framerate > 0) ? int64(framerate) : kUnlimited);
+
+	auto wants = _wants.current();
+	if (_known && wanted > wants.maxPixelCount) {
+		wants.maxPixelCount = int(wanted);
+		_lowerWindows = 0;
+		_lowerPeak = 0;
+		_wants = wants;
+	}
+}
+
+void VideoWantsTracker::finishWindow() {
+	auto wants = _wants.current();
+	finishPixelsWindow(wants);
+	finishFramerateWindow(wants);
+	_wants = wants;
+}
+
+void VideoWantsTracker::finishPixelsWindow(VideoTrackWants &wants) {
+	const auto peak = base::take(_windowPeak);
+	if (!peak) {
+		return;
+	} else if (!_known) {
+		_known = true;
+		wants.maxPixelCount = int(peak);
+	} else if (!Lower(peak, wants.maxPixelCount)) {
+		_lowerWindows = 0;
+		_lowerPeak = 0;
+	} else {
+		_lowerPeak = std::max(_lowerPeak, peak);
+		if (++_lowerWindows < kLowerWindowsToShrink) {
+			return;
+		}
+		_lowerWindows = 0;
+		wants.maxPixelCount = int(base::take(_lowerPeak));
+	}
+}
+
+void VideoWantsTracker::finishFramerateWindow(VideoTrackWants &wants) {
+	const auto framerate = base::take(_windowFramerate);
+	if (!framerate) {
+		return;
+	} else if (framerate <= wants.maxFramerate) {
+		_higherFramerateWindows = 0;
+		wants.maxFramerate = int(framerate);
+	} else if (++_higherFramerateWindows >= kHigherWindowsToSpeedUp) {
+		_higherFramerateWindows = 0;
+		wants.maxFramerate = int(framerate);
+	}
+}
+
+VideoTrackWants VideoWantsTracker::current() const {
+	return _wants.current();
+}
+
+rpl::producer<VideoTrackWants> VideoWantsTracker::value() const {
+	return _wants.value();
+}
+
+} // namespace Webrtc::details
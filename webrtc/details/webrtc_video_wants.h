@@ -0,0 +1,50 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include "webrtc/webrtc_video_track.h"
+
+namespace Webrtc::details {
+
+// Aggregates sizes requested by the consumers of one track.
+//
+// Growing wants are applied right away, so that a tile enlarged by the
+// user gets sharp as soon as possible, while shrinking wants are applied
+// only after they stay lower for a while, so that layout animations and
+// several views of different size don't make the source flip layers.
+//
+// The framerate is limited as soon as the consumer is seen skipping
+// frames for a whole window and unlimited again only after it keeps up
+// for a few seconds, so a source which got slower to let the consumer
+// catch up isn't sped up right away.
+class VideoWantsTracker final {
+public:
+	// Called from the main thread.
+	// Zero pixels mean the consumer paints the frame in its full size,
+	// zero framerate means it keeps up with all the frames it gets.
+	void requested(int64 pixels, int framerate, crl::time now);
+
+	[[nodiscard]] VideoTrackWants current() const;
+	[[nodiscard]] rpl::producer<VideoTrackWants> value() const;
+
+private:
+	void finishWindow();
+	void finishPixelsWindow(VideoTrackWants &wants);
+	void finishFramerateWindow(VideoTrackWants &wants);
+
+	rpl::variable<VideoTrackWants> _wants;
+	crl::time _windowStart = 0;
+	int64 _windowPeak = 0;
+	int64 _lowerPeak = 0;
+	int _lowerWindows = 0;
+	int64 _windowFramerate = 0;
+	int _higherFramerateWindows = 0;
+	bool _known = false;
+
+};
+
+} // namespace Webrtc::details
@@ -0,0 +1,147 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "webrtc/webrtc_video_fan_out.h"
+
+#include "webrtc/details/webrtc_shared_originals.h"
+
+#include <QtCore/QMutex>
+
+#include <array>
+
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_frame.h>
+
+namespace Webrtc {
+namespace {
+
+// Tracks read YUV420 and NV12 buffers without copying, anything else
+// (hardware buffers, high bit depth, I444) would be converted by each
+// of them, so it is converted here once.
+[[nodiscard]] rtc::scoped_refptr<webrtc::VideoFrameBuffer> ReadableBuffer(
+		rtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer) {
+	using Type = webrtc::VideoFrameBuffer::Type;
+
+	const auto type = buffer->type();
+	if (type == Type::kI420 || type == Type::kI420A || type == Type::kNV12) {
+		return buffer;
+	} else if (type == Type::kNative) {
+		// Hardware decoders may map their buffers to NV12 without copying.
+		auto types = std::array{ Type::kNV12 };
+		if (auto mapped = buffer->GetMappedFrameBuffer(types)) {
+			return mapped;
+		}
+	}
+	return buffer->ToI420();
+}
+
+} // namespace
+
+class VideoFanOut::Sink final : public SinkInterface {
+public:
+	Sink();
+
+	[[nodiscard]] auto originals() const
+	-> std::shared_ptr<details::SharedOriginals>;
+
+	void add(const std::shared_ptr<SinkInterface> &sink);
+	void remove(const std::shared_ptr<SinkInterface> &sink);
+
+	void OnFrame(const webrtc::VideoFrame &nativeVideoFrame) override;
+
+private:
+	const std::shared_ptr<details::SharedOriginals> _originals;
+
+	QMutex _mutex;
+	std::vector<std::weak_ptr<SinkInterface>> _sinks;
+
+	// Delivering thread.
+	std::vector<std::shared_ptr<SinkInterface>> _delivering;
+
+};
+
+VideoFanOut::Sink::Sink()
+: _originals(std::make_shared<details::SharedOriginals>()) {
+}
+
+auto VideoFanOut::Sink::originals() const
+-> std::shared_ptr<details::SharedOriginals> {
+	return _originals;
+}
+
+void VideoFanOut::Sink::add(const std::shared_ptr<SinkInterface> &sink) {
+	Expects(sink != nullptr);
+
+	auto lock = QMutexLocker(&_mutex);
+	_sinks.push_back(sink);
+}
+
+void VideoFanOut::Sink::remove(const std::shared_ptr<SinkInterface> &sink) {
+	auto lock = QMutexLocker(&_mutex);
+	_sinks.erase(ranges::remove_if(_sinks, [&](const auto &weak) {
+		const auto strong = weak.lock();
+		return !strong || (strong == sink);
+	}), end(_sinks));
+}
+
+void VideoFanOut::Sink::OnFrame(const webrtc::VideoFrame &nativeVideoFrame) {
+	{
+		auto lock = QMutexLocker(&_mutex);
+		_delivering.clear();
+		for (const auto &weak : _sinks) {
+			if (auto strong = weak.lock()) {
+				_delivering.push_back(std::move(strong));
+			}
+		}
+	}
+	if (_delivering.empty()) {
+		// Nobody reads the originals converted for the previous frames.
+		_originals->clear();
+		return;
+	}
+	auto buffer = ReadableBuffer(nativeVideoFrame.video_frame_buffer());
+	if (!buffer) {
+		_delivering.clear();
+		return;
+	}
+	auto converted = nativeVideoFrame;
+	converted.set_video_frame_buffer(std::move(buffer));
+	for (const auto &sink : _delivering) {
+		sink->OnFrame(converted);
+	}
+
+	// Don't keep the tracks alive until the next frame.
+	_delivering.clear();
+}
+
+VideoFanOut::VideoFanOut() : _sink(std::make_shared<Sink>()) {
+}
+
+VideoFanOut::~VideoFanOut() = default;
+
+std::shared_ptr<SinkInterface> VideoFanOut::sink() {
+	return _sink;
+}
+
+void VideoFanOut::add(const std::shared_ptr<SinkInterface> &sink) {
+	_sink->add(sink);
+}
+
+void VideoFanOut::remove(const std::shared_ptr<SinkInterface> &sink) {
+	_sink->remove(sink);
+}
+
+void VideoFanOut::add(not_null<VideoTrack*> track) {
+	track->shareOriginals(_sink->originals());
+	_sink->add(track->sink());
+}
+
+void VideoFanOut::remove(not_null<VideoTrack*> track) {
+	_sink->remove(track->sink());
+	track->shareOriginals(nullptr);
+}
+
+} // namespace Webrtc
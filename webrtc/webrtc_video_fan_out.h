@@ -0,0 +1,43 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include "webrtc/webrtc_video_track.h"
+
+namespace Webrtc {
+
+// Delivers the frames of one source to several tracks showing it (f.e.
+// in a grid, a pinned view and a picture-in-picture window), converting
+// them to a buffer the tracks read as is only once, on the delivering
+// thread. Tracks added as such share the ARGB32 originals as well, the
+// first one converting a frame does that for all the others. Each track
+// still keeps its own frames, state and requests.
+class VideoFanOut final {
+public:
+	VideoFanOut();
+	~VideoFanOut();
+
+	// Attach this one to the source instead of the sinks of the tracks.
+	[[nodiscard]] std::shared_ptr<SinkInterface> sink();
+
+	// Called from any thread. The sinks are held weakly, so destroyed
+	// tracks are skipped even without removing them.
+	void add(const std::shared_ptr<SinkInterface> &sink);
+	void remove(const std::shared_ptr<SinkInterface> &sink);
+
+	// Called from the main thread.
+	void add(not_null<VideoTrack*> track);
+	void remove(not_null<VideoTrack*> track);
+
+private:
+	class Sink;
+
+	const std::shared_ptr<Sink> _sink;
+
+};
+
+} // namespace Webrtc
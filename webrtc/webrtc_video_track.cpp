@@ -6,33 +6,100 @@
 //
 #include "webrtc/webrtc_video_track.h"
 
-#include "ffmpeg/ffmpeg_utility.h"
-
+#include "webrtc/details/webrtc_frame_decimator.h"
+#include "webrtc/details/webrtc_frame_exchange.h"
+#include "webrtc/details/webrtc_frame_mailbox.h"
+#include "webrtc/details/webrtc_frame_memory.h"
+#include "webrtc/details/webrtc_frame_notifier.h"
+#include "webrtc/details/webrtc_frame_pacer.h"
+#include "webrtc/details/webrtc_frame_rounding.h"
+#include "webrtc/details/webrtc_frame_storage_pool.h"
+#include "webrtc/details/webrtc_shared_originals.h"
+#include "webrtc/details/webrtc_video_convert.h"
+#include "webrtc/details/webrtc_video_stats.h"
+#include "webrtc/details/webrtc_video_wants.h"
+#include "base/timer.h"
+
+#include <crl/crl_async.h>
+#include <QtCore/QMutex>
 #include <QtGui/QImage>
 #include <QtGui/QPainter>
 
 #include <api/video/video_sink_interface.h>
 #include <api/video/video_frame.h>
+#include <api/video/i420_buffer.h>
+#include <common_video/include/video_frame_buffer_pool.h>
 
 namespace Webrtc {
 namespace {
 
 constexpr auto kDropFramesWhileInactive = 5 * crl::time(1000);
+constexpr auto kThumbnailScale = 4;
+constexpr auto kMaxPreparedRequests = 4;
+constexpr auto kForgetRequestTimeout = crl::time(1000);
+constexpr auto kEvictImagesTimeout = crl::time(1000);
+constexpr auto kEvictFrameTimeout = 10 * crl::time(1000);
+constexpr auto kDefaultFrameInterval = crl::time(33);
+constexpr auto kMaxFrameInterval = crl::time(1000);
+
+// A consumer slower than the source still paints every few frames,
+// a hidden or scrolled out tile doesn't paint at all.
+constexpr auto kPaintedFrameIntervals = 4;
+
+// Changed regions larger than this part of the frame are prepared anew.
+constexpr auto kIncrementalMaxDirtyPart = 4;
+
+[[nodiscard]] int FramesCount(const VideoTrackOptions &options) {
+	if (!options.pacedPresentation) {
+		return options.framesCount;
+	}
+	// Paced frames wait in the queue for up to `pacingLatency`, so it has
+	// to fit that many frames of a usual source besides the painted one
+	// and the one being written, or fresh frames are dropped on jitter.
+	const auto held = (options.pacingLatency + kDefaultFrameInterval - 1)
+		/ kDefaultFrameInterval;
+	return std::max(options.framesCount, int(held) + 2);
+}
+
+[[nodiscard]] int64 ImageBytes(const QImage &image) {
+	return int64(image.bytesPerLine()) * image.height();
+}
+
+[[nodiscard]] FrameYUV420 WrapI420(
+		not_null<const webrtc::I420BufferInterface*> buffer) {
+	return {
+		.size = { buffer->width(), buffer->height() },
+		.chromaSize = { buffer->ChromaWidth(), buffer->ChromaHeight() },
+		.y = { buffer->DataY(), buffer->StrideY() },
+		.u = { buffer->DataU(), buffer->StrideU() },
+		.v = { buffer->DataV(), buffer->StrideV() },
+	};
+}
+
+[[nodiscard]] FrameNV12 WrapNV12(
+		not_null<const webrtc::NV12BufferInterface*> buffer) {
+	return {
+		.size = { buffer->width(), buffer->height() },
+		.chromaSize = { buffer->ChromaWidth(), buffer->ChromaHeight() },
+		.y = { buffer->DataY(), buffer->StrideY() },
+		.uv = { buffer->DataUV(), buffer->StrideUV() },
+	};
+}
 
 [[nodiscard]] bool GoodForRequest(
-		const QImage &image,
+		QSize size,
 		int rotation,
 		const FrameRequest &request) {
 	if (request.resize.isEmpty()) {
 		return true;
 	} else if (rotation != 0) {
 		return false;
-	//} else if ((request.radius != ImageRoundRadius::None)
-	//	&& ((request.corners & RectPart::AllCorners) != 0)) {
-	//	return false;
+	} else if ((request.radius > 0)
+		&& (request.corners & FrameCorner::All)) {
+		return false;
 	}
 	return (request.resize == request.outer)
-		&& (request.resize == image.size());
+		&& (request.resize == size);
 }
 
 void PaintFrameOuter(QPainter &p, const QRect &inner, QSize outer) {
@@ -69,7 +136,8 @@ void PaintFrameInner(
 		QRect to,
 		const QImage &original,
 		bool alpha,
-		int rotation) {
+		int rotation,
+		FrameQuality quality) {
 	const auto rotated = [](QRect rect, int rotation) {
 		switch (rotation) {
 		case 0: return rect;
@@ -98,7 +166,10 @@ void PaintFrameInner(
 		QPainter::TextAntialiasing
 	};
 	for (const auto hint : hints) {
-		p.setRenderHint(hint);
+		const auto enabled = (quality == FrameQuality::High)
+			|| (quality == FrameQuality::Bilinear
+				&& hint == QPainter::SmoothPixmapTransform);
+		p.setRenderHint(hint, enabled);
 	}
 	if (rotation) {
 		p.rotate(rotation);
@@ -128,15 +199,14 @@ void PaintFrameContent(
 		size.width(),
 		size.height());
 	PaintFrameOuter(p, to, full);
-	PaintFrameInner(p, to, original, alpha, rotation);
+	PaintFrameInner(p, to, original, alpha, rotation, request.quality);
 }
 
 void ApplyFrameRounding(QImage &storage, const FrameRequest &request) {
-	//if (!(request.corners & RectPart::AllCorners)
-	//	|| (request.radius == ImageRoundRadius::None)) {
-	//	return;
-	//}
-	//Images::prepareRound(storage, request.radius, request.corners);
+	if (!(request.corners & FrameCorner::All) || (request.radius <= 0)) {
+		return;
+	}
+	details::ApplyRounding(storage, request.radius, request.corners);
 }
 
 QImage PrepareByRequest(
@@ -150,13 +220,63 @@ QImage PrepareByRequest(
 	const auto outer = request.outer.isEmpty()
 		? original.size()
 		: request.outer;
-	if (!FFmpeg::GoodStorageForFrame(storage, outer)) {
-		storage = FFmpeg::CreateFrameStorage(outer);
+	details::FrameStoragePool::Instance().ensure(storage, outer);
+
+	const auto size = request.resize.isEmpty()
+		? original.size()
+		: request.resize;
+	const auto inner = QRect(
+		(outer.width() - size.width()) / 2,
+		(outer.height() - size.height()) / 2,
+		size.width(),
+		size.height());
+	if (original.isNull()) {
+		// Pooled storages keep pixels of other tracks, don't show them.
+		storage.fill(Qt::black);
+	} else if (!alpha
+		&& original.depth() == 32
+		&& QRect(QPoint(), outer).contains(inner)) {
+		// Opaque letterboxed frames are written directly, each pixel once.
+		const auto scaled = details::ScaleToARGB32(
+			original,
+			storage,
+			inner,
+			rotation,
+			request.quality);
+		Assert(scaled);
+	} else {
+		QPainter p(&storage);
+		PaintFrameContent(p, original, alpha, rotation, request);
 	}
 
-	QPainter p(&storage);
-	PaintFrameContent(p, original, alpha, rotation, request);
-	p.end();
+	ApplyFrameRounding(storage, request);
+	return storage;
+}
+
+template <typename Planes>
+QImage PrepareByRequest(
+		const Planes &planes,
+		int rotation,
+		const FrameRequest &request,
+		QImage storage) {
+	Expects(!request.outer.isEmpty());
+	Expects(!request.resize.isEmpty());
+
+	const auto outer = request.outer;
+	details::FrameStoragePool::Instance().ensure(storage, outer);
+	const auto size = request.resize;
+	const auto inner = QRect(
+		(outer.width() - size.width()) / 2,
+		(outer.height() - size.height()) / 2,
+		size.width(),
+		size.height());
+	const auto converted = details::ConvertToARGB32(
+		planes,
+		storage,
+		inner,
+		rotation,
+		request.quality);
+	Assert(converted);
 
 	ApplyFrameRounding(storage, request);
 	return storage;
@@ -164,27 +284,170 @@ QImage PrepareByRequest(
 
 } // namespace
 
+struct VideoTrack::Thumbnail {
+	QImage image;
+	QImage prepared;
+	FrameRequest request = FrameRequest::NonStrict();
+	QSize frameSize;
+	FrameYUV420 yuv420;
+	FrameNV12 nv12;
+	int64 mcstimestamp = 0;
+	int index = -1;
+};
+
+struct FrameHandle::Data {
+	~Data();
+
+	FrameWithInfo info;
+	FrameYUV420 yuv420;
+	FrameNV12 nv12;
+	rtc::scoped_refptr<webrtc::VideoFrameBuffer> native;
+};
+
+FrameHandle::Data::~Data() {
+	// The track has moved on to other storages by now, reuse this one.
+	details::FrameStoragePool::Instance().release(std::move(info.original));
+}
+
+FrameHandle::FrameHandle(std::shared_ptr<const Data> data)
+: _data(std::move(data)) {
+}
+
+bool FrameHandle::empty() const {
+	return !_data;
+}
+
+const FrameWithInfo &FrameHandle::info() const {
+	Expects(_data != nullptr);
+
+	return _data->info;
+}
+
+struct VideoTrack::Prepared {
+	FrameRequest request = FrameRequest::NonStrict();
+	QImage image;
+	int64 key = 0;
+	bool ready = false;
+};
+
 struct VideoTrack::Frame {
 	int64 mcstimestamp = 0;
+	crl::profile_time presented = 0;
+	crl::profile_time arrived = 0;
 
 	QImage original;
-	QImage prepared;
-	rtc::scoped_refptr<webrtc::I420BufferInterface> native;
+	std::vector<Prepared> prepared;
+	rtc::scoped_refptr<webrtc::VideoFrameBuffer> native;
+	std::shared_ptr<details::SharedOriginals> shared;
 	FrameYUV420 yuv420;
-	FrameRequest request = FrameRequest::NonStrict();
+	FrameNV12 nv12;
 	FrameFormat format = FrameFormat::None;
 
 	int rotation = 0;
 	bool displayed = false;
 	bool alpha = false;
 	bool requireARGB32 = true;
+	bool originalReady = false;
+
+	// Counted in VideoTrackStats::framesConverted since it was decoded.
+	bool converted = false;
+
+	// Reported to FrameMemory by the current owner of the slot.
+	int64 bytes = 0;
+
+	// QImage::cacheKey() of the original right after it was converted,
+	// if it is still the same the storage wasn't touched since then.
+	int64 originalKey = 0;
+
+	[[nodiscard]] Prepared *findPrepared(const FrameRequest &request);
+	[[nodiscard]] not_null<Prepared*> addPrepared(
+		const FrameRequest &request);
+	[[nodiscard]] bool anyPreparedReady() const;
+	[[nodiscard]] int64 computeBytes() const;
+	void dropStalePrepared(const std::vector<FrameRequest> &requests);
+	void resetReady();
 };
 
+auto VideoTrack::Frame::findPrepared(const FrameRequest &request)
+-> Prepared* {
+	auto i = ranges::find_if(prepared, [&](const Prepared &entry) {
+		return entry.request.goodFor(request);
+	});
+	if (i == end(prepared)) {
+		i = ranges::find_if(prepared, [&](const Prepared &entry) {
+			return entry.request.sameViewAs(request);
+		});
+		if (i == end(prepared)) {
+			return nullptr;
+		}
+
+		// The view changed its quality, prepare it again in its storage.
+		i->request = request;
+		i->key = 0;
+		i->ready = false;
+	}
+
+	// The most recently used variant goes first.
+	ranges::rotate(begin(prepared), i, i + 1);
+	return &prepared.front();
+}
+
+auto VideoTrack::Frame::addPrepared(const FrameRequest &request)
+-> not_null<Prepared*> {
+	if (int(prepared.size()) >= kMaxPreparedRequests) {
+		// Views come and go, the least recently used variant is the last.
+		details::FrameStoragePool::Instance().release(
+			std::move(prepared.back().image));
+		prepared.pop_back();
+	}
+	prepared.insert(begin(prepared), Prepared{ .request = request });
+	return &prepared.front();
+}
+
+bool VideoTrack::Frame::anyPreparedReady() const {
+	return ranges::contains(prepared, true, &Prepared::ready);
+}
+
+int64 VideoTrack::Frame::computeBytes() const {
+	auto result = ImageBytes(original);
+	for (const auto &entry : prepared) {
+		result += ImageBytes(entry.image);
+	}
+	if (native) {
+		result += int64(yuv420.size.width()) * yuv420.size.height() * 3 / 2;
+	}
+	return result;
+}
+
+void VideoTrack::Frame::dropStalePrepared(
+		const std::vector<FrameRequest> &requests) {
+	const auto stale = [&](const Prepared &entry) {
+		return !ranges::contains(requests, entry.request);
+	};
+	auto &pool = details::FrameStoragePool::Instance();
+	for (auto &entry : prepared) {
+		if (stale(entry)) {
+			pool.release(std::move(entry.image));
+		}
+	}
+	prepared.erase(ranges::remove_if(prepared, stale), end(prepared));
+}
+
+void VideoTrack::Frame::resetReady() {
+	originalReady = false;
+	for (auto &entry : prepared) {
+		entry.ready = false;
+	}
+}
+
 class VideoTrack::Sink final
 	: public rtc::VideoSinkInterface<webrtc::VideoFrame>
+	, public details::FrameNotifier::Client
+	, public details::FrameMemory::Client
 	, public std::enable_shared_from_this<Sink> {
 public:
-	explicit Sink(bool requireARGB32);
+	explicit Sink(const VideoTrackOptions &options);
+	~Sink();
 
 	using PrepareFrame = not_null<Frame*>;
 	using PrepareState = bool;
@@ -198,90 +461,552 @@ public:
 
 	// Called from the main thread.
 	void markFrameShown();
+	[[nodiscard]] bool paced() const;
+	[[nodiscard]] std::optional<crl::profile_time> nextDue();
+	[[nodiscard]] crl::profile_time playoutNow() const;
+	void requested(const FrameRequest &request, crl::time now);
+	void painted(crl::time now);
+	[[nodiscard]] int keptUpFramerate() const;
+	int64 evict(crl::time now) override;
+	void prepareOriginal(not_null<Frame*> frame);
+	void prepareContent(
+		not_null<Frame*> frame,
+		not_null<Prepared*> prepared);
 	[[nodiscard]] not_null<Frame*> frameForPaint();
 	[[nodiscard]] FrameWithIndex frameForPaintWithIndex();
 	[[nodiscard]] rpl::producer<> renderNextFrameOnMain() const;
 	void destroyFrameForPaint();
+	[[nodiscard]] QImage thumbnail();
+	void setTrack(VideoTrack *track);
+	void setSharedOriginals(
+		std::shared_ptr<details::SharedOriginals> originals);
+	[[nodiscard]] VideoTrack *track() const;
+	void framesReady() override;
+
+	// Called from any thread.
+	[[nodiscard]] VideoTrackStats stats() const;
+
+	// Called from the render thread.
+	[[nodiscard]] std::shared_ptr<const FrameHandle::Data> acquireFrame();
 
 	void OnFrame(const webrtc::VideoFrame &nativeVideoFrame) override;
 
 private:
-	struct FrameForDecode {
-		not_null<Frame*> frame;
-		int counter = 0;
-	};
-	[[nodiscard]] FrameForDecode nextFrameForDecode();
-	void presentNextFrame(const FrameForDecode &frame);
-	[[nodiscard]] not_null<Frame*> getFrame(int index);
-	[[nodiscard]] not_null<const Frame*> getFrame(int index) const;
-	[[nodiscard]] int counter() const;
-
+	void scheduleFrame(const webrtc::VideoFrame &nativeVideoFrame);
+	void processScheduledFrames();
+	void processFrame(const webrtc::VideoFrame &nativeVideoFrame);
+	void writeFrame(const webrtc::VideoFrame &nativeVideoFrame);
 	bool decodeFrame(
 		const webrtc::VideoFrame &nativeVideoFrame,
 		not_null<Frame*> frame);
-	void notifyFrameDecoded();
-
-	FFmpeg::SwscalePointer _decodeContext;
+	[[nodiscard]] auto rotateBuffer(
+		rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+		int rotation)
+	-> rtc::scoped_refptr<webrtc::I420BufferInterface>;
+	void notifyFrameDecoded(crl::profile_time published);
+	void processRenderOnly(const webrtc::VideoFrame &nativeVideoFrame);
+	void prepareForRender(not_null<Frame*> frame);
+	void publishForRender(not_null<const Frame*> frame, int64 index);
+	void clearForRender();
+	void markFrameShownPaced();
+	void accumulateDirty(const webrtc::VideoFrame &nativeVideoFrame);
+	void countRecycledFrame(not_null<const Frame*> frame);
+	void countConversion(not_null<Frame*> frame);
+	void measureFrameInterval();
+	void pruneRequests(crl::time now);
+	[[nodiscard]] bool paintedRecently(crl::time painted, crl::time now) const;
+	[[nodiscard]] crl::time lastUsed() const;
+	[[nodiscard]] bool skipPreparation() const;
+	void account(not_null<Frame*> frame);
+	void releaseImages(not_null<Frame*> frame);
+	int64 releaseFrame(not_null<Frame*> frame, bool decoded);
+	int64 releaseFrames(bool decoded);
+	int64 releaseFramesForWrite();
+
+	const bool _lazyConversion = false;
+	const bool _asyncConversion = false;
+	const bool _acceptNV12 = false;
+	const bool _rotateYUV = false;
+	const Fn<crl::profile_time()> _playoutClock;
+	const std::unique_ptr<details::FramePacer> _pacer;
+	const Fn<void()> _renderFrameReady;
+
+	std::atomic<int64> _framesReceived = 0;
+	std::atomic<int64> _framesConverted = 0;
+	std::atomic<int64> _conversionsSkipped = 0;
+	std::atomic<int64> _framesDropped = 0;
+	std::atomic<int64> _framesShown = 0;
+	std::atomic<int64> _framesLate = 0;
+	details::LatencyHistogram _conversion;
+	details::LatencyHistogram _preparation;
+	details::LatencyHistogram _notification;
+	details::LatencyHistogram _presentation;
+	details::LatencyHistogram _pacing;
+	details::FrameDecimator _decimator;
+	std::atomic<crl::time> _frameInterval = kDefaultFrameInterval;
+
+	struct ActiveRequest {
+		FrameRequest request;
+		crl::time used = 0;
+	};
 
-	std::atomic<int> _counter = 0;
+	// Requests of all the views painting this track, for the producer
+	// to prepare each new frame for all of them at once.
+	QMutex _requestsMutex;
+	std::vector<ActiveRequest> _requests;
+	std::atomic<crl::time> _lastPainted = 0;
+	std::atomic<crl::time> _lastAcquired = 0;
+
+	// Producer thread.
+	crl::time _lastArrival = 0;
+	std::unique_ptr<webrtc::VideoFrameBufferPool> _rotatedBuffers;
+	std::vector<FrameRequest> _requestsForFrame;
+	std::vector<QRect> _dirty;
+
+	// Originals shared with the other tracks fed by the same VideoFanOut.
+	QMutex _sharedMutex;
+	std::shared_ptr<details::SharedOriginals> _shared;
+
+	// The frame for the render thread while all the slots are taken.
+	Frame _renderFrame;
+	int64 _renderIndex = 0;
+
+	// Held while a frame is processed, so that the main thread can
+	// release the frames owned by the producer while it is idle,
+	// or else ask it to release them after the current frame.
+	QMutex _producerMutex;
+	std::atomic<bool> _releaseRequested = false;
+
+	QMutex _scheduledMutex;
+	std::optional<webrtc::VideoFrame> _scheduled;
+	bool _processing = false;
+
+	details::FrameExchange<Frame> _frames;
+	std::atomic<crl::profile_time> _unnotifiedSince = 0;
+
+	// Latest frames for the render thread, the producer thread publishes
+	// them and the main thread clears them, serialized by the mutex.
+	using RenderFrame = std::shared_ptr<const FrameHandle::Data>;
+	QMutex _renderMutex;
+	std::unique_ptr<details::FrameMailbox<RenderFrame>> _renderFrames;
 
 	// Main thread.
-	int _counterCycle = 0;
-
-	static constexpr auto kFramesCount = 3;
-	std::array<Frame, kFramesCount> _frames;
-
+	crl::profile_time _paintingResumed = 0;
+	VideoTrack *_track = nullptr;
 	rpl::event_stream<> _renderNextFrameOnMain;
 
 };
 
-VideoTrack::Sink::Sink(bool requireARGB32) {
-	for (auto &frame : _frames) {
-		frame.requireARGB32 = requireARGB32;
-	}
+VideoTrack::Sink::Sink(const VideoTrackOptions &options)
+: _lazyConversion(options.lazyConversion)
+, _asyncConversion(options.asyncConversion)
+, _acceptNV12(options.acceptNV12)
+, _rotateYUV(options.rotateYUV)
+, _playoutClock(options.playoutClock
+	? options.playoutClock
+	: [] { return crl::profile(); })
+, _pacer(options.pacedPresentation
+	? std::make_unique<details::FramePacer>(options.pacingLatency)
+	: nullptr)
+, _renderFrameReady(options.renderFrameReady)
+, _dirty(FramesCount(options))
+, _frames(FramesCount(options))
+, _renderFrames(options.renderThreadAccess
+	? std::make_unique<details::FrameMailbox<RenderFrame>>()
+	: nullptr) {
+	_frames.enumerate([&](Frame &frame) {
+		frame.requireARGB32 = options.requireARGB32;
+	});
+	_renderFrame.requireARGB32 = options.requireARGB32;
+}
+
+VideoTrack::Sink::~Sink() {
+	const auto release = [&](Frame &frame) {
+		releaseImages(&frame);
+		frame.native = nullptr;
+		account(&frame);
+	};
+	_frames.enumerate(release);
+	release(_renderFrame);
 }
 
 void VideoTrack::Sink::OnFrame(const webrtc::VideoFrame &nativeVideoFrame) {
-	const auto decode = nextFrameForDecode();
-	if (decodeFrame(nativeVideoFrame, decode.frame)) {
-		PrepareFrameByRequests(decode.frame, nativeVideoFrame.rotation());
-		presentNextFrame(decode);
+	_framesReceived.fetch_add(1, std::memory_order_relaxed);
+	measureFrameInterval();
+	if (_asyncConversion) {
+		scheduleFrame(nativeVideoFrame);
+	} else {
+		processFrame(nativeVideoFrame);
+	}
+}
+
+void VideoTrack::Sink::scheduleFrame(
+		const webrtc::VideoFrame &nativeVideoFrame) {
+	auto lock = QMutexLocker(&_scheduledMutex);
+	if (_scheduled) {
+		_framesDropped.fetch_add(1, std::memory_order_relaxed);
+
+		// Keep the changes of the dropped frame for incremental conversion.
+		auto updated = nativeVideoFrame;
+		if (_scheduled->has_update_rect()
+			&& updated.has_update_rect()
+			&& _scheduled->width() == updated.width()
+			&& _scheduled->height() == updated.height()) {
+			auto rect = updated.update_rect();
+			rect.Union(_scheduled->update_rect());
+			updated.set_update_rect(rect);
+		} else {
+			updated.clear_update_rect();
+		}
+		_scheduled = std::move(updated);
+	} else {
+		_scheduled = nativeVideoFrame;
+	}
+	if (_processing) {
+		return;
+	}
+	_processing = true;
+	lock.unlock();
+
+	crl::async([weak = weak_from_this()] {
+		if (const auto strong = weak.lock()) {
+			strong->processScheduledFrames();
+		}
+	});
+}
+
+void VideoTrack::Sink::processScheduledFrames() {
+	// Only one task per sink is queued or running at any moment, so the
+	// frames are processed in order and _frames has a single producer.
+	while (true) {
+		auto lock = QMutexLocker(&_scheduledMutex);
+		if (!_scheduled) {
+			_processing = false;
+			return;
+		}
+		const auto frame = base::take(_scheduled);
+		lock.unlock();
+
+		processFrame(*frame);
+	}
+}
+
+void VideoTrack::Sink::processFrame(
+		const webrtc::VideoFrame &nativeVideoFrame) {
+	auto lock = QMutexLocker(&_producerMutex);
+	writeFrame(nativeVideoFrame);
+	if (_releaseRequested.exchange(false)) {
+		releaseFramesForWrite();
+	}
+}
+
+void VideoTrack::Sink::writeFrame(
+		const webrtc::VideoFrame &nativeVideoFrame) {
+	accumulateDirty(nativeVideoFrame);
+	if (_decimator.skip()) {
+		return;
+	}
+	const auto frame = _frames.slotForWrite();
+	if (!frame) {
+		// All the other frames are waiting to be shown on the main thread,
+		// drop this one, unless it still can be shown on the render thread.
+		if (_renderFrames) {
+			processRenderOnly(nativeVideoFrame);
+		} else {
+			_framesDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		const auto painted = _lastPainted.load(std::memory_order_relaxed);
+		if (!_pacer && paintedRecently(painted, crl::now())) {
+			// Paced frames are held in the queue on purpose and nobody
+			// shows the frames of a track that isn't painted.
+			_decimator.queueFull();
+		}
+		return;
+	}
+	countRecycledFrame(frame);
+	auto &dirty = _dirty[_frames.indexForWrite() % _frames.depth()];
+	const auto decoding = details::LatencyMeasure();
+	if (decodeFrame(nativeVideoFrame, frame)) {
+		decoding.add(_conversion);
+		if (!_lazyConversion && frame->format == FrameFormat::ARGB32) {
+			if (skipPreparation()) {
+				// Nobody paints this track and the memory is short,
+				// convert on demand if it gets painted before the next one.
+				releaseImages(frame);
+			} else {
+				{
+					auto lock = QMutexLocker(&_requestsMutex);
+					pruneRequests(crl::now());
+					_requestsForFrame.clear();
+					for (const auto &active : _requests) {
+						_requestsForFrame.push_back(active.request);
+					}
+				}
+				// Sources reporting changed regions (screen capture)
+				// are kept up to date incrementally from the original.
+				const auto preparing = details::LatencyMeasure();
+				const auto updated = nativeVideoFrame.has_update_rect()
+					&& PrepareFrameIncrementally(
+						frame,
+						dirty,
+						_requestsForFrame);
+				if (!updated) {
+					PrepareFrameByRequests(
+						frame,
+						frame->rotation,
+						_requestsForFrame);
+				}
+				if (frame->originalReady) {
+					dirty = QRect();
+				}
+				preparing.add(_preparation);
+			}
+		}
+
+		if (_renderFrames) {
+			prepareForRender(frame);
+		}
+		countConversion(frame);
+
+		// Release this frame to the main thread for rendering.
+		account(frame);
+		if (_pacer) {
+			frame->arrived = _playoutClock();
+			_pacer->arrived(frame->mcstimestamp, frame->arrived);
+		}
+		frame->presented = crl::profile();
+		if (_renderFrames) {
+			publishForRender(frame, _frames.indexForWrite());
+		}
+		_frames.publish();
+		notifyFrameDecoded(frame->presented);
 	}
 }
 
-auto VideoTrack::Sink::nextFrameForDecode() -> FrameForDecode {
-	const auto current = counter();
-	const auto index = ((current + 3) / 2) % kFramesCount;
-	const auto frame = getFrame(index);
-	return { frame, current };
+void VideoTrack::Sink::processRenderOnly(
+		const webrtc::VideoFrame &nativeVideoFrame) {
+	// The handles of the previous render frame share its buffer and its
+	// original, so decoding here never changes what they point to.
+	const auto frame = &_renderFrame;
+	const auto decoding = details::LatencyMeasure();
+	if (!decodeFrame(nativeVideoFrame, frame)) {
+		_framesDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	decoding.add(_conversion);
+	prepareForRender(frame);
+	countConversion(frame);
+	account(frame);
+	publishForRender(frame, _frames.indexForWrite());
 }
 
-void VideoTrack::Sink::presentNextFrame(const FrameForDecode &frame) {
-	// Release this frame to the main thread for rendering.
-	const auto present = [&](int counter) {
-		Expects(counter + 1 < 2 * kFramesCount);
+void VideoTrack::Sink::prepareForRender(not_null<Frame*> frame) {
+	// The render thread can't convert the frame itself, it gets either
+	// the original or the planes when the memory is short, but only
+	// the YUV420 ones unless it accepts NV12.
+	const auto planesOnly = skipPreparation()
+		&& (_acceptNV12 || !frame->nv12.y.data);
+	if (frame->requireARGB32 && !planesOnly) {
+		const auto preparing = details::LatencyMeasure();
+		PrepareFrameOriginal(frame);
+		preparing.add(_preparation);
+	}
+}
 
-		_counter.store(counter + 1, std::memory_order_release);
-		notifyFrameDecoded();
+void VideoTrack::Sink::publishForRender(
+		not_null<const Frame*> frame,
+		int64 index) {
+	// Frames published only for the render thread come in between.
+	_renderIndex = std::max(index, _renderIndex + 1);
+
+	// The handle shares the buffer and the original with the slot, so the
+	// slot gets fresh ones when it is written next time (see frameHandle).
+	auto data = std::make_shared<FrameHandle::Data>();
+	data->native = frame->native;
+	data->yuv420 = frame->yuv420;
+	data->nv12 = frame->nv12;
+	const auto original = (frame->format == FrameFormat::ARGB32)
+		&& frame->originalReady;
+	const auto format = [&] {
+		if (frame->format != FrameFormat::ARGB32 || original) {
+			return frame->format;
+		}
+		// Not converted yet, the renderer gets the planes instead.
+		if (!frame->nv12.y.data) {
+			return FrameFormat::YUV420;
+		}
+		Assert(_acceptNV12);
+		return FrameFormat::NV12;
+	}();
+	data->info = {
+		.mcstimestamp = frame->mcstimestamp,
+		.original = original ? frame->original : QImage(),
+		.yuv420 = &data->yuv420,
+		.nv12 = &data->nv12,
+		.format = format,
+		.rotation = frame->rotation,
+		.index = int(_renderIndex),
 	};
-	switch (frame.counter) {
-	case 0: present(0);
-	case 1: return;
-	case 2: present(2);
-	case 3: return;
-	case 4: present(4);
-	case 5: return;
-	//case 6: present(6);
-	//case 7: return;
+	{
+		auto lock = QMutexLocker(&_renderMutex);
+		_renderFrames->back() = std::move(data);
+		_renderFrames->publish();
+	}
+	if (_renderFrameReady) {
+		_renderFrameReady();
 	}
-	Unexpected("Counter value in VideoTrack::Sink::presentNextFrame.");
+}
+
+void VideoTrack::Sink::clearForRender() {
+	if (!_renderFrames) {
+		return;
+	}
+	auto lock = QMutexLocker(&_renderMutex);
+	_renderFrames->back() = nullptr;
+	_renderFrames->publish();
+}
+
+auto VideoTrack::Sink::acquireFrame()
+-> std::shared_ptr<const FrameHandle::Data> {
+	Expects(_renderFrames != nullptr);
+
+	_lastAcquired.store(crl::now(), std::memory_order_relaxed);
+	_renderFrames->update();
+	return _renderFrames->front();
+}
+
+void VideoTrack::Sink::accumulateDirty(
+		const webrtc::VideoFrame &nativeVideoFrame) {
+	const auto full = QRect(
+		0,
+		0,
+		nativeVideoFrame.width(),
+		nativeVideoFrame.height());
+	const auto rect = [&] {
+		if (!nativeVideoFrame.has_update_rect()) {
+			return full;
+		}
+		const auto &updated = nativeVideoFrame.update_rect();
+		return QRect(
+			updated.offset_x,
+			updated.offset_y,
+			updated.width,
+			updated.height).intersected(full);
+	}();
+	if (rect.isEmpty()) {
+		return;
+	}
+
+	// Each slot remembers all the changes since it was last updated
+	// incrementally, including the ones of frames skipped or written
+	// to other slots, so its original can be brought up to date.
+	for (auto &dirty : _dirty) {
+		dirty |= rect;
+	}
+}
+
+void VideoTrack::Sink::countRecycledFrame(not_null<const Frame*> frame) {
+	if (frame->format == FrameFormat::ARGB32 && !frame->converted) {
+		_conversionsSkipped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void VideoTrack::Sink::countConversion(not_null<Frame*> frame) {
+	if (frame->converted
+		|| frame->format != FrameFormat::ARGB32
+		|| !(frame->originalReady || frame->anyPreparedReady())) {
+		return;
+	}
+	frame->converted = true;
+	_framesConverted.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VideoTrack::Sink::measureFrameInterval() {
+	const auto now = crl::now();
+	if (_lastArrival && now >= _lastArrival) {
+		const auto interval = std::min(now - _lastArrival, kMaxFrameInterval);
+		const auto was = _frameInterval.load(std::memory_order_relaxed);
+		_frameInterval.store(
+			(3 * was + interval) / 4,
+			std::memory_order_relaxed);
+	}
+	_lastArrival = now;
+}
+
+int VideoTrack::Sink::keptUpFramerate() const {
+	// Only each `factor` frame is shown while the consumer lags.
+	const auto factor = _decimator.factor();
+	if (factor <= 1) {
+		return 0;
+	}
+	const auto interval = std::max(
+		_frameInterval.load(std::memory_order_relaxed),
+		crl::time(1));
+	return std::max(int(1000 / (interval * factor)), 1);
+}
+
+bool VideoTrack::Sink::paintedRecently(
+		crl::time painted,
+		crl::time now) const {
+	const auto interval = _frameInterval.load(std::memory_order_relaxed);
+	return (painted + kPaintedFrameIntervals * interval >= now);
+}
+
+crl::time VideoTrack::Sink::lastUsed() const {
+	// Frames acquired on the render thread are painted there.
+	return std::max(
+		_lastPainted.load(std::memory_order_relaxed),
+		_lastAcquired.load(std::memory_order_relaxed));
+}
+
+bool VideoTrack::Sink::skipPreparation() const {
+	return (lastUsed() + kEvictImagesTimeout < crl::now())
+		&& details::FrameMemory::Instance().overBudget();
+}
+
+void VideoTrack::Sink::account(not_null<Frame*> frame) {
+	const auto bytes = frame->computeBytes();
+	if (const auto delta = bytes - frame->bytes) {
+		frame->bytes = bytes;
+		details::FrameMemory::Instance().add(delta);
+	}
+}
+
+VideoTrackStats VideoTrack::Sink::stats() const {
+	return {
+		.framesReceived = _framesReceived.load(std::memory_order_relaxed),
+		.framesConverted = _framesConverted.load(std::memory_order_relaxed),
+		.conversionsSkipped = _conversionsSkipped.load(
+			std::memory_order_relaxed),
+		.framesDropped = _framesDropped.load(std::memory_order_relaxed),
+		.framesDecimated = _decimator.skippedCount(),
+		.framesShown = _framesShown.load(std::memory_order_relaxed),
+		.decimation = _decimator.factor(),
+		.conversion = _conversion.snapshot(),
+		.preparation = _preparation.snapshot(),
+		.notification = _notification.snapshot(),
+		.presentation = _presentation.snapshot(),
+		.framesLate = _framesLate.load(std::memory_order_relaxed),
+		.jitter = _pacer ? _pacer->jitter() : 0,
+		.pacingDelay = _pacer ? _pacer->targetDelay() : 0,
+		.pacing = _pacing.snapshot(),
+	};
 }
 
 bool VideoTrack::Sink::decodeFrame(
 		const webrtc::VideoFrame &nativeVideoFrame,
 		not_null<Frame*> frame) {
-	const auto native = nativeVideoFrame.video_frame_buffer()->ToI420();
-	const auto size = QSize{ native->width(), native->height() };
+	using Type = webrtc::VideoFrameBuffer::Type;
+
+	auto buffer = nativeVideoFrame.video_frame_buffer();
+	if (buffer->type() == Type::kNative) {
+		// Hardware decoders may map their buffers to NV12 without copying.
+		auto types = std::array{ Type::kNV12 };
+		if (auto mapped = buffer->GetMappedFrameBuffer(types)) {
+			buffer = std::move(mapped);
+		}
+	}
+	const auto size = QSize{ buffer->width(), buffer->height() };
 	if (size.isEmpty()) {
 		frame->format = FrameFormat::None;
 		return false;
@@ -290,124 +1015,305 @@ bool VideoTrack::Sink::decodeFrame(
 	if (!frame->mcstimestamp) {
 		frame->mcstimestamp = crl::now() * 1000;
 	}
+	frame->resetReady();
+	frame->converted = false;
+	frame->rotation = nativeVideoFrame.rotation();
+
+	// ARGB32 conversion handles rotation itself, while preparing the frame.
+	const auto rotate = _rotateYUV
+		&& !frame->requireARGB32
+		&& (frame->rotation != 0);
+
+	// Both ARGB32 conversion and NV12-aware consumers read NV12 as is,
+	// anything else is converted to (or already is) YUV420.
+	const auto nv12 = (buffer->type() == Type::kNV12)
+		&& (frame->requireARGB32 || (_acceptNV12 && !rotate));
+	if (nv12) {
+		frame->native = buffer;
+		frame->nv12 = WrapNV12(buffer->GetNV12());
+		frame->yuv420 = FrameYUV420{ .size = size };
+	} else {
+		const auto i420 = rotate
+			? rotateBuffer(buffer->ToI420(), frame->rotation)
+			: buffer->ToI420();
+		if (!i420) {
+			frame->format = FrameFormat::None;
+			return false;
+		} else if (rotate) {
+			frame->rotation = 0;
+		}
+		frame->native = i420;
+		frame->nv12 = FrameNV12();
+		frame->yuv420 = WrapI420(i420.get());
+	}
 	if (!frame->requireARGB32) {
 		if (!frame->original.isNull()) {
-			frame->original = frame->prepared = QImage();
+			releaseImages(frame);
 		}
-		frame->format = FrameFormat::YUV420;
-		frame->native = native;
-		frame->yuv420 = FrameYUV420{
-			.size = size,
-			.chromaSize = { native->ChromaWidth(), native->ChromaHeight() },
-			.y = { native->DataY(), native->StrideY() },
-			.u = { native->DataU(), native->StrideU() },
-			.v = { native->DataV(), native->StrideV() },
-		};
+		frame->shared = nullptr;
+		frame->format = nv12 ? FrameFormat::NV12 : FrameFormat::YUV420;
+
+		// The planes are all the consumers read, they are converted now.
+		frame->converted = true;
+		_framesConverted.fetch_add(1, std::memory_order_relaxed);
 		return true;
 	}
+	{
+		auto lock = QMutexLocker(&_sharedMutex);
+		frame->shared = _shared;
+	}
+	// The ARGB32 conversion itself is done later, in PrepareFrameByRequests
+	// or on demand, when we know if the full size original is needed.
 	frame->format = FrameFormat::ARGB32;
-	frame->yuv420 = FrameYUV420{
-		.size = size,
-	};
-	if (!FFmpeg::GoodStorageForFrame(frame->original, size)) {
-		frame->original = FFmpeg::CreateFrameStorage(size);
-	}
-	_decodeContext = FFmpeg::MakeSwscalePointer(
-		size,
-		AV_PIX_FMT_YUV420P,
-		size,
-		AV_PIX_FMT_BGRA,
-		&_decodeContext);
-	Assert(_decodeContext != nullptr);
-
-	// AV_NUM_DATA_POINTERS defined in AVFrame struct
-	const uint8_t *src[AV_NUM_DATA_POINTERS] = {
-		native->DataY(),
-		native->DataU(),
-		native->DataV(),
-		nullptr
-	};
-	int srcLineSize[AV_NUM_DATA_POINTERS] = {
-		native->StrideY(),
-		native->StrideU(),
-		native->StrideV(),
-		0
-	};
-	uint8_t *dst[AV_NUM_DATA_POINTERS] = { frame->original.bits(), nullptr };
-	int dstLineSize[AV_NUM_DATA_POINTERS] = { int(frame->original.bytesPerLine()), 0 };
+	return true;
+}
 
-	sws_scale(
-		_decodeContext.get(),
-		src,
-		srcLineSize,
-		0,
-		frame->original.height(),
-		dst,
-		dstLineSize);
+auto VideoTrack::Sink::rotateBuffer(
+	rtc::scoped_refptr<webrtc::I420BufferInterface> buffer,
+	int rotation)
+-> rtc::scoped_refptr<webrtc::I420BufferInterface> {
+	if (!buffer) {
+		return nullptr;
+	}
+	const auto turned = (rotation == 90 || rotation == 270);
+	const auto width = turned ? buffer->height() : buffer->width();
+	const auto height = turned ? buffer->width() : buffer->height();
+	if (!_rotatedBuffers) {
+		// Enough for all the slots and a few buffers held by handles.
+		constexpr auto kMaxBuffers = 16;
+		_rotatedBuffers = std::make_unique<webrtc::VideoFrameBufferPool>(
+			false,
+			kMaxBuffers);
+	}
+	const auto result = _rotatedBuffers->CreateI420Buffer(width, height);
+	if (!result) {
+		return nullptr;
+	}
+	const auto rotated = details::RotateYUV420(
+		WrapI420(buffer.get()),
+		WrapI420(result.get()),
+		rotation);
+	return rotated ? result : nullptr;
+}
 
-	return true;
+void VideoTrack::Sink::releaseImages(not_null<Frame*> frame) {
+	auto &pool = details::FrameStoragePool::Instance();
+	pool.release(std::move(frame->original));
+	for (auto &prepared : frame->prepared) {
+		pool.release(std::move(prepared.image));
+	}
+	frame->prepared.clear();
 }
 
-void VideoTrack::Sink::notifyFrameDecoded() {
-	crl::on_main([weak = weak_from_this()] {
-		if (const auto strong = weak.lock()) {
-			strong->_renderNextFrameOnMain.fire({});
-		}
+int64 VideoTrack::Sink::releaseFrame(not_null<Frame*> frame, bool decoded) {
+	const auto was = frame->bytes;
+	releaseImages(frame);
+	if (decoded) {
+		frame->native = nullptr;
+		frame->yuv420 = FrameYUV420();
+		frame->nv12 = FrameNV12();
+		frame->format = FrameFormat::None;
+	}
+	frame->resetReady();
+	account(frame);
+	return was - frame->bytes;
+}
+
+int64 VideoTrack::Sink::releaseFrames(bool decoded) {
+	// The frames waiting to be shown belong to the main thread.
+	auto result = int64(0);
+	_frames.enumerateForRead([&](Frame &frame) {
+		result += releaseFrame(&frame, decoded);
+	});
+	if (_producerMutex.tryLock()) {
+		result += releaseFramesForWrite();
+		_producerMutex.unlock();
+	} else {
+		_releaseRequested = true;
+	}
+	return result;
+}
+
+int64 VideoTrack::Sink::releaseFramesForWrite() {
+	// Frames owned by the producer were shown already, they are kept
+	// only to be updated incrementally and will be decoded anew anyway.
+	auto result = int64(0);
+	_frames.enumerateForWrite([&](Frame &frame) {
+		result += releaseFrame(&frame, true);
 	});
+	result += releaseFrame(&_renderFrame, true);
+	return result;
 }
 
-int VideoTrack::Sink::counter() const {
-	return _counter.load(std::memory_order_acquire);
+void VideoTrack::Sink::notifyFrameDecoded(crl::profile_time published) {
+	// Notifications are batched, measure from the oldest unnotified frame.
+	auto unnotified = crl::profile_time(0);
+	_unnotifiedSince.compare_exchange_strong(unnotified, published);
+	details::FrameNotifier::Instance().notify(shared_from_this());
 }
 
-not_null<VideoTrack::Frame*> VideoTrack::Sink::getFrame(int index) {
-	Expects(index >= 0 && index < kFramesCount);
+void VideoTrack::Sink::framesReady() {
+	if (const auto since = _unnotifiedSince.exchange(0)) {
+		_notification.add(crl::profile() - since);
+	}
+	_renderNextFrameOnMain.fire({});
+}
 
-	return &_frames[index];
+void VideoTrack::Sink::setSharedOriginals(
+		std::shared_ptr<details::SharedOriginals> originals) {
+	auto lock = QMutexLocker(&_sharedMutex);
+	_shared = std::move(originals);
 }
 
-not_null<const VideoTrack::Frame*> VideoTrack::Sink::getFrame(
-		int index) const {
-	Expects(index >= 0 && index < kFramesCount);
+void VideoTrack::Sink::setTrack(VideoTrack *track) {
+	_track = track;
+}
 
-	return &_frames[index];
+VideoTrack *VideoTrack::Sink::track() const {
+	return _track;
 }
 
 // Sometimes main thread subscribes to check frame requests before
 // the first frame is ready and presented and sometimes after.
 bool VideoTrack::Sink::firstPresentHappened() const {
-	switch (counter()) {
-	case 0: return false;
-	case 1: return true;
+	return _frames.firstPublishHappened();
+}
+
+void VideoTrack::Sink::markFrameShown() {
+	if (_pacer) {
+		markFrameShownPaced();
+	} else if (_frames.markShown()) {
+		auto &frame = _frames.slotForRead();
+		frame.displayed = true;
+
+		const auto lag = crl::profile() - frame.presented;
+		_framesShown.fetch_add(1, std::memory_order_relaxed);
+		_presentation.add(lag);
+		if (frame.presented >= _paintingResumed) {
+			// Frames queued while the track wasn't painted lag on purpose.
+			_decimator.shown(lag / 1000);
+		}
 	}
-	Unexpected("Counter value in VideoTrack::Sink::firstPresentHappened.");
 }
 
- void VideoTrack::Sink::markFrameShown() {
-	const auto jump = [&](int counter) {
-		if (counter == 2 * kFramesCount - 1) {
-			++_counterCycle;
+void VideoTrack::Sink::markFrameShownPaced() {
+	// Move to the newest frame that is due, the ones before it are late.
+	const auto now = _playoutClock();
+	auto due = crl::profile_time();
+	auto advanced = false;
+	while (const auto next = _frames.nextForRead()) {
+		const auto nextDue = _pacer->due(next->mcstimestamp);
+		if (nextDue > now) {
+			break;
+		} else if (advanced) {
+			_framesLate.fetch_add(1, std::memory_order_relaxed);
 		}
-		const auto next = (counter + 1) % (2 * kFramesCount);
-		const auto index = next / 2;
-		const auto frame = getFrame(index);
-		frame->displayed = true;
-		_counter.store(
-			next,
-			std::memory_order_release);
-	};
+		_frames.markShown();
+		due = nextDue;
+		advanced = true;
+	}
+	if (!advanced) {
+		return;
+	}
+	auto &frame = _frames.slotForRead();
+	frame.displayed = true;
+
+	_framesShown.fetch_add(1, std::memory_order_relaxed);
+	_presentation.add(crl::profile() - frame.presented);
+	_pacing.add(now - frame.arrived);
+	if (frame.presented >= _paintingResumed) {
+		_decimator.shown(std::max(now - due, crl::profile_time(0)) / 1000);
+	}
+}
+
+bool VideoTrack::Sink::paced() const {
+	return (_pacer != nullptr);
+}
+
+std::optional<crl::profile_time> VideoTrack::Sink::nextDue() {
+	Expects(_pacer != nullptr);
 
-	switch (counter()) {
-	case 0: return;
-	case 1: return jump(1);
-	case 2: return;
-	case 3: return jump(3);
-	case 4: return;
-	case 5: return jump(5);
-	//case 6: return;
-	//case 7: return jump(7);
+	const auto next = _frames.nextForRead();
+	if (!next) {
+		return std::nullopt;
+	}
+	return _pacer->due(next->mcstimestamp);
+}
+
+crl::profile_time VideoTrack::Sink::playoutNow() const {
+	return _playoutClock();
+}
+
+void VideoTrack::Sink::prepareOriginal(not_null<Frame*> frame) {
+	if (frame->format != FrameFormat::ARGB32 || frame->originalReady) {
+		return;
 	}
-	Unexpected("Counter value in VideoTrack::Sink::markFrameShown.");
+	const auto preparing = details::LatencyMeasure();
+	PrepareFrameOriginal(frame);
+	preparing.add(_preparation);
+	countConversion(frame);
+	account(frame);
+}
+
+void VideoTrack::Sink::prepareContent(
+		not_null<Frame*> frame,
+		not_null<Prepared*> prepared) {
+	const auto preparing = details::LatencyMeasure();
+	PrepareFrameContent(frame, prepared);
+	preparing.add(_preparation);
+	countConversion(frame);
+	account(frame);
+}
+
+void VideoTrack::Sink::painted(crl::time now) {
+	const auto was = _lastPainted.exchange(now, std::memory_order_relaxed);
+	if (!paintedRecently(was, now)) {
+		// Start adapting from scratch, as if the track was just created.
+		_paintingResumed = crl::profile();
+		_decimator.reset();
+	}
+}
+
+int64 VideoTrack::Sink::evict(crl::time now) {
+	const auto painted = lastUsed();
+	if (painted + kEvictImagesTimeout > now) {
+		return 0;
+	}
+	// For a while keep the decoded frames waiting to be shown,
+	// to convert them again if they get painted.
+	const auto destroy = (painted + kEvictFrameTimeout <= now);
+	if (destroy) {
+		clearForRender();
+	}
+	return releaseFrames(destroy);
+}
+
+void VideoTrack::Sink::pruneRequests(crl::time now) {
+	// Forget the views that stopped painting this track.
+	_requests.erase(ranges::remove_if(_requests, [&](const ActiveRequest &a) {
+		return (a.used + kForgetRequestTimeout < now);
+	}), end(_requests));
+}
+
+void VideoTrack::Sink::requested(const FrameRequest &request, crl::time now) {
+	auto lock = QMutexLocker(&_requestsMutex);
+	pruneRequests(now);
+
+	const auto i = ranges::find_if(_requests, [&](const ActiveRequest &a) {
+		return a.request.sameViewAs(request);
+	});
+	if (i != end(_requests)) {
+		// The view may have switched its quality, keep only the last one.
+		i->request = request;
+		i->used = now;
+		return;
+	} else if (int(_requests.size()) >= kMaxPreparedRequests) {
+		_requests.erase(ranges::min_element(
+			_requests,
+			ranges::less(),
+			&ActiveRequest::used));
+	}
+	_requests.push_back({ .request = request, .used = now });
 }
 
 not_null<VideoTrack::Frame*> VideoTrack::Sink::frameForPaint() {
@@ -415,23 +1321,45 @@ not_null<VideoTrack::Frame*> VideoTrack::Sink::frameForPaint() {
 }
 
 VideoTrack::Sink::FrameWithIndex VideoTrack::Sink::frameForPaintWithIndex() {
-	const auto index = counter() / 2;
 	return {
-		.frame = getFrame(index),
-		.index = (_counterCycle * 2 * kFramesCount) + index,
+		.frame = &_frames.slotForRead(),
+		.index = int(_frames.indexForRead()),
 	};
 }
 
 void VideoTrack::Sink::destroyFrameForPaint() {
-	const auto frame = getFrame(counter() / 2);
-	if (!frame->original.isNull()) {
-		frame->original = frame->prepared = QImage();
+	clearForRender();
+	releaseFrames(true);
+}
+
+QImage VideoTrack::Sink::thumbnail() {
+	const auto frame = &_frames.slotForRead();
+	if (frame->format == FrameFormat::None) {
+		return QImage();
 	}
-	if (frame->native) {
-		frame->native = nullptr;
+	const auto size = frame->yuv420.size;
+	const auto turned = (frame->rotation == 90 || frame->rotation == 270);
+	const auto full = turned ? size.transposed() : size;
+	const auto scaled = QSize(
+		std::max(full.width() / kThumbnailScale, 1),
+		std::max(full.height() / kThumbnailScale, 1));
+	const auto request = FrameRequest{
+		.resize = scaled,
+		.outer = scaled,
+		.strict = true,
+	};
+	if (frame->alpha || !frame->native) {
+		PrepareFrameOriginal(frame);
+		return PrepareByRequest(
+			frame->original,
+			frame->alpha,
+			frame->rotation,
+			request,
+			QImage());
+	} else if (frame->nv12.y.data) {
+		return PrepareByRequest(frame->nv12, frame->rotation, request, {});
 	}
-	frame->yuv420 = FrameYUV420();
-	frame->format = FrameFormat::None;
+	return PrepareByRequest(frame->yuv420, frame->rotation, request, {});
 }
 
 rpl::producer<> VideoTrack::Sink::renderNextFrameOnMain() const {
@@ -439,24 +1367,90 @@ rpl::producer<> VideoTrack::Sink::renderNextFrameOnMain() const {
 }
 
 VideoTrack::VideoTrack(VideoState state, bool requireARGB32)
-: _state(state) {
-	_sink = std::make_shared<Sink>(requireARGB32);
+: VideoTrack(state, VideoTrackOptions{ .requireARGB32 = requireARGB32 }) {
+}
+
+VideoTrack::VideoTrack(VideoState state, VideoTrackOptions options)
+: _sink(std::make_shared<Sink>(options))
+, _wants(std::make_unique<details::VideoWantsTracker>())
+, _state(state) {
+	_sink->setTrack(this);
+	_sink->painted(crl::now());
+	details::FrameMemory::Instance().registerClient(_sink);
+
+	if (_sink->paced()) {
+		_pacingTimer = std::make_unique<base::Timer>([=] {
+			_pacedRenders.fire({});
+		});
+		_sink->renderNextFrameOnMain(
+		) | rpl::start_with_next([=] {
+			schedulePacedRender();
+		}, _lifetime);
+	}
 }
 
 VideoTrack::~VideoTrack() {
+	_sink->setTrack(nullptr);
+	clearThumbnail();
+}
+
+auto VideoTrack::NewFramesBatches()
+-> rpl::producer<std::vector<not_null<VideoTrack*>>> {
+	using Client = details::FrameNotifier::Client;
+	return details::FrameNotifier::Instance().batches(
+	) | rpl::map([](const std::vector<not_null<Client*>> &clients) {
+		// All the notifier clients are sinks of video tracks.
+		auto result = std::vector<not_null<VideoTrack*>>();
+		result.reserve(clients.size());
+		for (const auto client : clients) {
+			const auto sink = static_cast<Sink*>(client.get());
+			if (const auto track = sink->track()) {
+				result.push_back(track);
+			}
+		}
+		return result;
+	}) | rpl::filter([](const std::vector<not_null<VideoTrack*>> &tracks) {
+		return !tracks.empty();
+	});
 }
 
 rpl::producer<> VideoTrack::renderNextFrame() const {
 	return rpl::merge(
-		_sink->renderNextFrameOnMain(),
+		(_sink->paced()
+			? _pacedRenders.events()
+			: _sink->renderNextFrameOnMain()),
 		_state.changes() | rpl::to_empty);
 }
 
+void VideoTrack::schedulePacedRender() {
+	const auto due = _sink->nextDue();
+	if (!due) {
+		return;
+	}
+	// Always through the timer, so that renderNextFrame() is never fired
+	// from inside of markFrameShown() called by a painting consumer.
+	const auto wait = *due - _sink->playoutNow();
+	const auto delay = std::max((wait + 999) / 1000, crl::profile_time(0));
+	_pacingTimer->callOnce(crl::time(delay));
+}
+
 auto VideoTrack::sink()
 -> std::shared_ptr<rtc::VideoSinkInterface<webrtc::VideoFrame>> {
 	return _sink;
 }
 
+VideoTrackStats VideoTrack::stats() const {
+	return _sink->stats();
+}
+
+VideoTrackWants VideoTrack::wants() const {
+	return _wants->current();
+}
+
+rpl::producer<VideoTrackWants> VideoTrack::wantsValue() const {
+	return _wants->value();
+}
+
 [[nodiscard]] VideoState VideoTrack::state() const {
 	return _state.current();
 }
@@ -471,60 +1465,154 @@ auto VideoTrack::sink()
 
 void VideoTrack::setState(VideoState state) {
 	if (state == VideoState::Inactive) {
+		// Keep only a small copy of the last frame to show meanwhile.
+		saveThumbnail();
 		_inactiveFrom = crl::now();
 	} else {
 		_inactiveFrom = 0;
 	}
 	_state = state;
 	if (state == VideoState::Inactive) {
-		// save last frame?..
 		_sink->destroyFrameForPaint();
 	}
 }
 
+void VideoTrack::shareOriginals(
+		std::shared_ptr<details::SharedOriginals> originals) {
+	_sink->setSharedOriginals(std::move(originals));
+}
+
+void VideoTrack::saveThumbnail() {
+	const auto size = frameSize();
+	const auto mcstimestamp = _sink->frameForPaint()->mcstimestamp;
+	auto image = _sink->thumbnail();
+	if (image.isNull()) {
+		// Nothing new since the last thumbnail, keep that one.
+		return;
+	}
+	clearThumbnail();
+	_thumbnail = std::make_unique<Thumbnail>(Thumbnail{
+		.image = std::move(image),
+		.frameSize = size,
+		.mcstimestamp = mcstimestamp,
+
+		// Frames are indexed from zero up, thumbnails from -2 down,
+		// so that each one differs from any other and from no frame.
+		.index = --_thumbnailIndex,
+	});
+	_thumbnail->yuv420.size = _thumbnail->image.size();
+}
+
+void VideoTrack::clearThumbnail() {
+	if (const auto thumbnail = base::take(_thumbnail)) {
+		auto &pool = details::FrameStoragePool::Instance();
+		pool.release(std::move(thumbnail->image));
+		pool.release(std::move(thumbnail->prepared));
+	}
+}
+
+bool VideoTrack::thumbnailShown() const {
+	if (!_thumbnail) {
+		return false;
+	} else if (_inactiveFrom > 0
+		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now())) {
+		return true;
+	}
+	return (_sink->frameForPaint()->format == FrameFormat::None);
+}
+
+QImage VideoTrack::thumbnailFrame(const FrameRequest &request) {
+	Expects(_thumbnail != nullptr);
+
+	if (request.resize.isEmpty()) {
+		return _thumbnail->image;
+	} else if (_thumbnail->prepared.isNull()
+		|| !_thumbnail->request.goodFor(request)) {
+		_thumbnail->request = request;
+		_thumbnail->prepared = PrepareByRequest(
+			_thumbnail->image,
+			false,
+			0,
+			request,
+			std::move(_thumbnail->prepared));
+	}
+	return _thumbnail->prepared;
+}
+
 void VideoTrack::markFrameShown() {
 	_sink->markFrameShown();
+	if (_pacingTimer) {
+		schedulePacedRender();
+	}
 }
 
 QImage VideoTrack::frame(const FrameRequest &request) {
-	if (_inactiveFrom > 0
-		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now())) {
+	const auto inactive = (_inactiveFrom > 0)
+		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now());
+	if (inactive) {
 		_sink->destroyFrameForPaint();
+	}
+	if (thumbnailShown()) {
+		return thumbnailFrame(request);
+	} else if (inactive) {
 		return {};
+	} else if (_thumbnail
+		&& _sink->frameForPaint()->format != FrameFormat::None) {
+		// Real frames are back, the thumbnail is not needed anymore.
+		clearThumbnail();
 	}
+	const auto now = crl::now();
+	_sink->painted(now);
+	_wants->requested(
+		(request.resize.isEmpty()
+			? 0
+			: int64(request.resize.width()) * request.resize.height()),
+		_sink->keptUpFramerate(),
+		now);
+
+	// Each view painting this track gets its own prepared variant.
 	const auto frame = _sink->frameForPaint();
-	const auto preparedFor = frame->request;
-	const auto changed = !preparedFor.goodFor(request);
-	const auto useRequest = changed ? request : preparedFor;
-	if (changed) {
-		//_wrapped.with([=](Implementation &unwrapped) {
-		//	unwrapped.updateFrameRequest(instance, useRequest);
-		//});
-	}
+	const auto existing = frame->findPrepared(request);
+	const auto useRequest = existing ? existing->request : request;
+	_sink->requested(useRequest, now);
 	if (!frame->alpha
-		&& GoodForRequest(frame->original, frame->rotation, useRequest)) {
+		&& GoodForRequest(frame->yuv420.size, frame->rotation, useRequest)) {
+		_sink->prepareOriginal(frame);
 		return frame->original;
-	} else if (changed || frame->prepared.isNull()) {
-		if (changed) {
-			frame->request = useRequest;
-		}
-		frame->prepared = PrepareByRequest(
-			frame->original,
-			frame->alpha,
-			frame->rotation,
-			useRequest,
-			std::move(frame->prepared));
 	}
-	return frame->prepared;
+	const auto prepared = existing
+		? not_null<Prepared*>(existing)
+		: frame->addPrepared(useRequest);
+	if (!prepared->ready) {
+		_sink->prepareContent(frame, prepared);
+	}
+	return prepared->image;
 }
 
 FrameWithInfo VideoTrack::frameWithInfo(bool requireARGB32) const {
 	if (_inactiveFrom > 0
 		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now())) {
 		_sink->destroyFrameForPaint();
-		return {};
+		if (!_thumbnail) {
+			return {};
+		}
 	}
+	if (thumbnailShown()) {
+		return {
+			.mcstimestamp = _thumbnail->mcstimestamp,
+			.original = _thumbnail->image,
+			.yuv420 = &_thumbnail->yuv420,
+			.nv12 = &_thumbnail->nv12,
+			.format = FrameFormat::ARGB32,
+			.index = _thumbnail->index,
+		};
+	}
+	const auto now = crl::now();
+	_sink->painted(now);
+	_wants->requested(0, _sink->keptUpFramerate(), now);
+
 	const auto data = _sink->frameForPaintWithIndex();
+	_sink->prepareOriginal(data.frame);
 	Assert(!requireARGB32
 		|| (data.frame->format == FrameFormat::ARGB32)
 		|| (data.frame->format == FrameFormat::None));
@@ -535,16 +1623,46 @@ FrameWithInfo VideoTrack::frameWithInfo(bool requireARGB32) const {
 		.mcstimestamp = data.frame->mcstimestamp,
 		.original = data.frame->original,
 		.yuv420 = &data.frame->yuv420,
+		.nv12 = &data.frame->nv12,
 		.format = data.frame->format,
 		.rotation = data.frame->rotation,
 		.index = data.index,
 	};
 }
 
+FrameHandle VideoTrack::frameHandle(bool requireARGB32) const {
+	auto info = frameWithInfo(requireARGB32);
+	if (info.format == FrameFormat::None) {
+		return FrameHandle();
+	}
+
+	// Slots referenced by a handle are not written in place later: the
+	// buffer is replaced by a new one and the ARGB32 storage is shared
+	// with the handle, so the sink takes a fresh one from the pool.
+	auto data = std::make_shared<FrameHandle::Data>();
+	data->native = _sink->frameForPaint()->native;
+	data->yuv420 = *info.yuv420;
+	data->nv12 = *info.nv12;
+	data->info = std::move(info);
+	data->info.yuv420 = &data->yuv420;
+	data->info.nv12 = &data->nv12;
+	return FrameHandle(std::move(data));
+}
+
+FrameHandle VideoTrack::acquireFrame() const {
+	auto data = _sink->acquireFrame();
+	return data ? FrameHandle(std::move(data)) : FrameHandle();
+}
+
 QSize VideoTrack::frameSize() const {
-	if (_inactiveFrom > 0
-		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now())) {
+	const auto inactive = (_inactiveFrom > 0)
+		&& (_inactiveFrom + kDropFramesWhileInactive > crl::now());
+	if (inactive) {
 		_sink->destroyFrameForPaint();
+	}
+	if (thumbnailShown()) {
+		return _thumbnail->frameSize;
+	} else if (inactive) {
 		return {};
 	}
 	const auto frame = _sink->frameForPaint();
@@ -557,23 +1675,233 @@ QSize VideoTrack::frameSize() const {
 
 void VideoTrack::PrepareFrameByRequests(
 		not_null<Frame*> frame,
-		int rotation) {
-	Expects(frame->format != FrameFormat::ARGB32
-		|| !frame->original.isNull());
+		int rotation,
+		const std::vector<FrameRequest> &requests) {
+	Expects(frame->format != FrameFormat::ARGB32 || frame->native);
 
 	frame->rotation = rotation;
 	if (frame->format != FrameFormat::ARGB32) {
 		return;
 	}
+
+	// Drop the variants no view asks for anymore.
+	frame->dropStalePrepared(requests);
+
+	if (requests.empty()) {
+		// Nothing was painted yet, most likely in the full size.
+		PrepareFrameOriginal(frame);
+		return;
+	}
+	for (const auto &request : requests) {
+		const auto size = frame->yuv420.size;
+		if (!frame->alpha && GoodForRequest(size, rotation, request)) {
+			PrepareFrameOriginal(frame);
+			continue;
+		}
+		const auto existing = frame->findPrepared(request);
+		const auto prepared = existing
+			? not_null<Prepared*>(existing)
+			: frame->addPrepared(request);
+		if (!prepared->ready) {
+			PrepareFrameContent(frame, prepared);
+		}
+	}
+}
+
+bool VideoTrack::PrepareFrameIncrementally(
+		not_null<Frame*> frame,
+		QRect dirty,
+		const std::vector<FrameRequest> &requests) {
+	Expects(frame->format == FrameFormat::ARGB32);
+
+	// Only the unrotated opaque frames are scaled from the original,
+	// the rest is prepared from the planes each time. Shared originals
+	// are read by other tracks, they can't be updated in place.
 	if (frame->alpha
-		|| !GoodForRequest(frame->original, rotation, frame->request)) {
-		frame->prepared = PrepareByRequest(
+		|| frame->rotation != 0
+		|| !frame->native
+		|| frame->shared) {
+		return false;
+	}
+	const auto size = frame->yuv420.size;
+	const auto full = QRect(QPoint(), size);
+	auto &original = frame->original;
+
+	// Converting the whole original and scaling the variants from it is
+	// more work than preparing them from the planes directly, it pays off
+	// only for small changes and while some variant can be updated.
+	const auto area = [](QRect rect) {
+		return int64(rect.width()) * rect.height();
+	};
+	const auto incremental = [&](const FrameRequest &request) {
+		if (GoodForRequest(size, 0, request)) {
+			return true;
+		}
+		const auto rounded = (request.radius > 0)
+			&& (request.corners & FrameCorner::All);
+		return !rounded
+			&& request.resize.width() <= request.outer.width()
+			&& request.resize.height() <= request.outer.height();
+	};
+	if (area(dirty) * kIncrementalMaxDirtyPart > area(full)
+		|| (!requests.empty() && !ranges::any_of(requests, incremental))) {
+		return false;
+	} else if (original.size() != size
+		|| original.cacheKey() != frame->originalKey) {
+		// The slot content is stale, convert everything this time
+		// to update only the changes in the next frames.
+		details::FrameStoragePool::Instance().ensure(original, size);
+		dirty = full;
+	}
+	if (!dirty.isEmpty()) {
+		const auto converted = frame->nv12.y.data
+			? details::ConvertRectToARGB32(frame->nv12, original, dirty)
+			: details::ConvertRectToARGB32(frame->yuv420, original, dirty);
+		Assert(converted);
+	}
+	frame->originalKey = original.cacheKey();
+	frame->originalReady = true;
+
+	frame->dropStalePrepared(requests);
+	for (const auto &request : requests) {
+		if (GoodForRequest(size, 0, request)) {
+			continue;
+		}
+		const auto existing = frame->findPrepared(request);
+		const auto prepared = existing
+			? not_null<Prepared*>(existing)
+			: frame->addPrepared(request);
+		const auto outer = request.outer;
+		const auto inner = QRect(
+			(outer.width() - request.resize.width()) / 2,
+			(outer.height() - request.resize.height()) / 2,
+			request.resize.width(),
+			request.resize.height());
+		const auto rounded = (request.radius > 0)
+			&& (request.corners & FrameCorner::All);
+		if (rounded || !QRect(QPoint(), outer).contains(inner)) {
+			PrepareFrameContent(frame, prepared);
+			prepared->key = 0;
+			continue;
+		}
+		auto &image = prepared->image;
+		const auto valid = (image.size() == outer)
+			&& (image.cacheKey() == prepared->key);
+		if (!valid) {
+			details::FrameStoragePool::Instance().ensure(image, outer);
+			const auto scaled = details::ScaleToARGB32(
+				original,
+				image,
+				inner,
+				request.quality);
+			Assert(scaled);
+		} else if (!dirty.isEmpty()) {
+			// Filters read the neighbours, take a small margin.
+			const auto map = [](int value, int from, int to) {
+				return int(int64(value) * to / from);
+			};
+			const auto left = map(dirty.x(), size.width(), inner.width());
+			const auto top = map(dirty.y(), size.height(), inner.height());
+			const auto right = map(
+				dirty.x() + dirty.width(),
+				size.width(),
+				inner.width());
+			const auto bottom = map(
+				dirty.y() + dirty.height(),
+				size.height(),
+				inner.height());
+			const auto clip = QRect(left, top, right - left, bottom - top)
+				.marginsAdded({ 2, 2, 2, 2 })
+				.translated(inner.topLeft());
+			const auto scaled = details::ScaleToARGB32(
+				original,
+				image,
+				inner,
+				request.quality,
+				clip);
+			Assert(scaled);
+		}
+		prepared->key = image.cacheKey();
+		prepared->ready = true;
+	}
+	return true;
+}
+
+void VideoTrack::PrepareFrameOriginal(not_null<Frame*> frame) {
+	if (frame->format != FrameFormat::ARGB32 || frame->originalReady) {
+		return;
+	}
+	Assert(frame->native != nullptr);
+
+	auto &pool = details::FrameStoragePool::Instance();
+	const auto convert = [&](QImage &storage) {
+		pool.ensure(storage, frame->yuv420.size);
+		const auto converted = frame->nv12.y.data
+			? details::ConvertToARGB32(frame->nv12, storage)
+			: details::ConvertToARGB32(frame->yuv420, storage);
+		Assert(converted);
+	};
+	if (frame->shared) {
+		// Other tracks fed by the same VideoFanOut may have converted it.
+		pool.release(std::move(frame->original));
+		frame->original = frame->shared->original(
+			frame->native.get(),
+			convert);
+	} else {
+		convert(frame->original);
+	}
+
+	frame->originalKey = frame->original.cacheKey();
+	frame->originalReady = true;
+}
+
+void VideoTrack::PrepareFrameContent(
+		not_null<Frame*> frame,
+		not_null<Prepared*> prepared) {
+	// Without alpha we go straight from the YUV420 planes to the
+	// requested size, rotation and letterbox, the original is not needed.
+	if (frame->alpha || !frame->native) {
+		PrepareFrameOriginal(frame);
+		prepared->image = PrepareByRequest(
 			frame->original,
 			frame->alpha,
-			rotation,
-			frame->request,
-			std::move(frame->prepared));
+			frame->rotation,
+			prepared->request,
+			std::move(prepared->image));
+	} else if (frame->nv12.y.data) {
+		prepared->image = PrepareByRequest(
+			frame->nv12,
+			frame->rotation,
+			prepared->request,
+			std::move(prepared->image));
+	} else {
+		prepared->image = PrepareByRequest(
+			frame->yuv420,
+			frame->rotation,
+			prepared->request,
+			std::move(prepared->image));
 	}
+	prepared->ready = true;
+}
+
+void SetFrameStorageLimit(int64 bytes) {
+	details::FrameStoragePool::Instance().setLimit(bytes);
+}
+
+FrameStorageStats GetFrameStorageStats() {
+	return details::FrameStoragePool::Instance().stats();
+}
+
+void SetVideoMemoryBudget(int64 bytes) {
+	details::FrameMemory::Instance().setBudget(bytes);
+}
+
+VideoMemoryStats GetVideoMemoryStats() {
+	return details::FrameMemory::Instance().stats();
+}
+
+void SetFrameNotificationInterval(crl::time interval) {
+	details::FrameNotifier::Instance().setTickInterval(interval);
 }
 
 } // namespace Webrtc
@@ -6,10 +6,20 @@
 //
 #pragma once
 
+#include "base/flags.h"
+
+#include <crl/crl_time.h>
 #include <rpl/variable.h>
+#include <QtCore/QRect>
 #include <QtCore/QSize>
 #include <QtGui/QImage>
 
+#include <array>
+
+namespace base {
+class Timer;
+} // namespace base
+
 namespace rtc {
 template <typename VideoFrameT>
 class VideoSinkInterface;
@@ -23,12 +33,32 @@ namespace Webrtc {
 
 using SinkInterface = rtc::VideoSinkInterface<webrtc::VideoFrame>;
 
+enum class FrameCorner : uchar {
+	None = 0x00,
+	TopLeft = 0x01,
+	TopRight = 0x02,
+	BottomLeft = 0x04,
+	BottomRight = 0x08,
+	All = 0x0F,
+};
+inline constexpr bool is_flag_type(FrameCorner) { return true; }
+using FrameCorners = base::flags<FrameCorner>;
+
+// Cheaper tiers suit tiles moving in layout animations,
+// the high quality one suits static layouts.
+enum class FrameQuality : uchar {
+	Fast, // Nearest neighbour, no smoothing when painting.
+	Bilinear,
+	High, // Box filter when downscaling, all the smoothing when painting.
+};
+
 struct FrameRequest {
 	QSize resize;
 	QSize outer;
-	//ImageRoundRadius radius = ImageRoundRadius();
-	//RectParts corners = RectPart::AllCorners;
+	int radius = 0;
+	FrameCorners corners = FrameCorner::All;
 	bool strict = true;
+	FrameQuality quality = FrameQuality::High;
 
 	static FrameRequest NonStrict() {
 		auto result = FrameRequest();
@@ -41,10 +71,7 @@ struct FrameRequest {
 	}
 
 	[[nodiscard]] bool operator==(const FrameRequest &other) const {
-		return (resize == other.resize)
-			&& (outer == other.outer)/*
-			&& (radius == other.radius)
-			&& (corners == other.corners)*/;
+		return sameViewAs(other) && (quality == other.quality);
 	}
 	[[nodiscard]] bool operator!=(const FrameRequest &other) const {
 		return !(*this == other);
@@ -53,6 +80,14 @@ struct FrameRequest {
 	[[nodiscard]] bool goodFor(const FrameRequest &other) const {
 		return (*this == other) || (strict && !other.strict);
 	}
+
+	// A view switching its quality tier asks for the same geometry.
+	[[nodiscard]] bool sameViewAs(const FrameRequest &other) const {
+		return (resize == other.resize)
+			&& (outer == other.outer)
+			&& (radius == other.radius)
+			&& (corners == other.corners);
+	}
 };
 
 enum class VideoState {
@@ -65,6 +100,7 @@ enum class FrameFormat {
 	None,
 	ARGB32,
 	YUV420,
+	NV12,
 };
 
 struct FrameChannel {
@@ -80,44 +116,269 @@ struct FrameYUV420 {
 	FrameChannel v;
 };
 
+struct FrameNV12 {
+	QSize size;
+	QSize chromaSize;
+	FrameChannel y;
+	FrameChannel uv;
+};
+
 struct FrameWithInfo {
 	int64 mcstimestamp = 0;
 	QImage original;
 	FrameYUV420 *yuv420 = nullptr;
+	FrameNV12 *nv12 = nullptr;
 	FrameFormat format = FrameFormat::None;
 	int rotation = 0;
 	int index = -1;
 };
 
+// Keeps the frame buffers alive until destroyed, so that the frame can
+// be read on any thread after the track has moved on to the next ones.
+class FrameHandle final {
+public:
+	FrameHandle() = default;
+
+	[[nodiscard]] bool empty() const;
+	[[nodiscard]] explicit operator bool() const {
+		return !empty();
+	}
+
+	// Pointers in the info are valid while the handle is alive.
+	[[nodiscard]] const FrameWithInfo &info() const;
+
+private:
+	friend class VideoTrack;
+	struct Data;
+
+	explicit FrameHandle(std::shared_ptr<const Data> data);
+
+	std::shared_ptr<const Data> _data;
+
+};
+
+struct VideoTrackOptions {
+	bool requireARGB32 = true;
+
+	// The frame being painted plus the frames queued after it, at least 2.
+	// Deeper queues absorb main thread hiccups without dropping frames,
+	// but each queued frame adds a frame of latency while main lags.
+	int framesCount = 2;
+
+	// YUV consumers get NV12 frames from hardware decoders as they are,
+	// without copying them to YUV420, with FrameFormat::NV12.
+	bool acceptNV12 = false;
+
+	// YUV consumers get the frames already rotated and rotation = 0.
+	bool rotateYUV = false;
+
+	// Keep only the decoded YUV420 buffer in the sink and convert it
+	// to ARGB32 when the frame is requested for painting for the first
+	// time, so that frames that are never painted cost nothing.
+	bool lazyConversion = false;
+
+	// Convert frames on the shared thread pool instead of the thread that
+	// delivers them. Frames of one track are processed in order, a frame
+	// arriving while the previous one still waits is dropped in its favor.
+	bool asyncConversion = false;
+
+	// Hold converted frames and show them at the pace of their timestamps
+	// against `playoutClock` (microseconds, crl::profile() by default),
+	// delaying them by at most `pacingLatency` to absorb the jitter.
+	// When a newer frame is due the older ones are dropped as late.
+	// The queue is made deep enough to hold `pacingLatency` of frames
+	// at 30 fps, unless `framesCount` is larger.
+	bool pacedPresentation = false;
+	crl::time pacingLatency = 150;
+	Fn<crl::profile_time()> playoutClock;
+
+	// Hand each converted frame to VideoTrack::acquireFrame() as well,
+	// for a renderer running on its own thread. `renderFrameReady` is
+	// called on the converting thread when a new frame can be acquired.
+	// Such frames are not paced, they are available as soon as converted.
+	bool renderThreadAccess = false;
+	Fn<void()> renderFrameReady;
+};
+
+// Latency samples in microseconds, bucket i counts the samples
+// in [2^i, 2^(i+1)) with the first one counting zero as well
+// and the last one counting everything above.
+struct VideoLatencyStats {
+	static constexpr auto kBuckets = 24;
+
+	std::array<int64, kBuckets> buckets = {};
+	int64 count = 0;
+	int64 sum = 0;
+	int64 max = 0;
+
+	[[nodiscard]] int64 average() const;
+	[[nodiscard]] int64 percentile(float64 fraction) const;
+};
+
+struct VideoTrackStats {
+	int64 framesReceived = 0;
+
+	// Frames converted to what the consumers read, ARGB32 images or
+	// the planes for the tracks not requiring ARGB32, and the ARGB32 ones
+	// replaced by newer frames before anything was converted from them.
+	int64 framesConverted = 0;
+	int64 conversionsSkipped = 0;
+	int64 framesDropped = 0;
+	int64 framesDecimated = 0;
+	int64 framesShown = 0;
+
+	// Only each `decimation` frame is converted while the consumer lags.
+	int decimation = 1;
+
+	// Converting a received buffer to YUV420 or NV12 (and rotating it).
+	VideoLatencyStats conversion;
+
+	// Preparing ARGB32 images by requests, in the sink or on demand.
+	VideoLatencyStats preparation;
+
+	// From publishing a frame until the main thread is notified about it.
+	VideoLatencyStats notification;
+
+	// From publishing a frame until it is marked as shown.
+	VideoLatencyStats presentation;
+
+	// Paced presentation: frames dropped because a newer one was due,
+	// estimated arrival jitter and the delay added to absorb it,
+	// in microseconds, and the time frames were held by the playout clock.
+	int64 framesLate = 0;
+	int64 jitter = 0;
+	int64 pacingDelay = 0;
+	VideoLatencyStats pacing;
+};
+
+// What the consumers of a track need from its source, to be applied
+// to the source as rtc::VideoSinkWants by the owner of the track.
+struct VideoTrackWants {
+	int maxPixelCount = std::numeric_limits<int>::max();
+	int maxFramerate = std::numeric_limits<int>::max();
+
+	friend inline bool operator==(
+		const VideoTrackWants &a,
+		const VideoTrackWants &b) = default;
+};
+
+// Frame storages are shared by all the tracks in the process.
+struct FrameStorageStats {
+	int64 hits = 0;
+	int64 misses = 0;
+	int64 bytesHeld = 0;
+	int64 bytesLimit = 0;
+};
+
+void SetFrameStorageLimit(int64 bytes);
+[[nodiscard]] FrameStorageStats GetFrameStorageStats();
+
+// Memory held by the frames of all the tracks in the process.
+//
+// Over the budget the idle frame storages are freed, tracks not painted
+// for a while release their ARGB32 images and, after a longer while,
+// their last decoded frame as well.
+struct VideoMemoryStats {
+	int64 bytesUsed = 0;
+	int64 bytesPooled = 0;
+	int64 bytesBudget = 0;
+	int64 evictions = 0;
+	int64 bytesEvicted = 0;
+};
+
+void SetVideoMemoryBudget(int64 bytes);
+[[nodiscard]] VideoMemoryStats GetVideoMemoryStats();
+
+// New frame notifications of all the tracks are delivered to the main
+// thread together, with a positive interval they are delayed until the
+// next multiple of it (f.e. the display refresh interval).
+// Called from the main thread.
+void SetFrameNotificationInterval(crl::time interval);
+
+namespace details {
+class VideoWantsTracker;
+class SharedOriginals;
+} // namespace details
+
 class VideoTrack final {
 public:
 	// Called from the main thread.
 	explicit VideoTrack(
 		VideoState state,
 		bool requireARGB32 = true);
+	VideoTrack(VideoState state, VideoTrackOptions options);
 	~VideoTrack();
 
 	void markFrameShown();
 	[[nodiscard]] QImage frame(const FrameRequest &request);
 	[[nodiscard]] FrameWithInfo frameWithInfo(bool requireARGB32) const;
+	[[nodiscard]] FrameHandle frameHandle(bool requireARGB32) const;
+
+	// Called from one dedicated thread (f.e. a render thread), it never
+	// waits for the main thread or the converting one. Returns the latest
+	// converted frame, the same one until a newer arrives, which is
+	// released by destroying the handle. Handles may be passed on to other
+	// threads. Requires VideoTrackOptions::renderThreadAccess.
+	[[nodiscard]] FrameHandle acquireFrame() const;
 	[[nodiscard]] QSize frameSize() const;
 	[[nodiscard]] rpl::producer<> renderNextFrame() const;
 	[[nodiscard]] std::shared_ptr<SinkInterface> sink();
+	[[nodiscard]] VideoTrackStats stats() const;
+
+	// Largest frame size recently requested for painting and the framerate
+	// the painting keeps up with, with hysteresis.
+	[[nodiscard]] VideoTrackWants wants() const;
+	[[nodiscard]] rpl::producer<VideoTrackWants> wantsValue() const;
 
 	[[nodiscard]] VideoState state() const;
 	[[nodiscard]] rpl::producer<VideoState> stateValue() const;
 	[[nodiscard]] rpl::producer<VideoState> stateChanges() const;
 	void setState(VideoState state);
 
+	// All the tracks that got new frames in one batch of notifications,
+	// fired after renderNextFrame() of each of them.
+	[[nodiscard]] static auto NewFramesBatches()
+	-> rpl::producer<std::vector<not_null<VideoTrack*>>>;
+
 private:
+	friend class VideoFanOut;
+
 	class Sink;
 	struct Frame;
+	struct Prepared;
+	struct Thumbnail;
+
+	static void PrepareFrameByRequests(
+		not_null<Frame*> frame,
+		int rotation,
+		const std::vector<FrameRequest> &requests);
+	[[nodiscard]] static bool PrepareFrameIncrementally(
+		not_null<Frame*> frame,
+		QRect dirty,
+		const std::vector<FrameRequest> &requests);
+	static void PrepareFrameOriginal(not_null<Frame*> frame);
+	static void PrepareFrameContent(
+		not_null<Frame*> frame,
+		not_null<Prepared*> prepared);
+
+	// Called by VideoFanOut when it starts or stops feeding this track.
+	void shareOriginals(std::shared_ptr<details::SharedOriginals> originals);
 
-	static void PrepareFrameByRequests(not_null<Frame*> frame, int rotation);
+	void schedulePacedRender();
+	void saveThumbnail();
+	void clearThumbnail();
+	[[nodiscard]] bool thumbnailShown() const;
+	[[nodiscard]] QImage thumbnailFrame(const FrameRequest &request);
 
 	std::shared_ptr<Sink> _sink;
+	const std::unique_ptr<details::VideoWantsTracker> _wants;
+	std::unique_ptr<Thumbnail> _thumbnail;
+	int _thumbnailIndex = -1;
+	std::unique_ptr<base::Timer> _pacingTimer;
+	rpl::event_stream<> _pacedRenders;
 	crl::time _inactiveFrom = 0;
 	rpl::variable<VideoState> _state;
+	rpl::lifetime _lifetime;
 };
 
 } // namespace Webrtc